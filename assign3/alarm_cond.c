@@ -14,61 +14,469 @@
 #include <time.h>
 #include "errors.h"
 #include <semaphore.h>
+#include <stddef.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <limits.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
 
 
 
 #define DEBUG 1
 #define DEGUG 2
-
-/*A linked list structure that holds the information about the Type A alarm requests*/
+/*the readers-writers protocols of an rw_lock_t, the futex and pthread
+backends run RW_FAIR as RW_WRITER_PREF*/
+#define RW_READER_PREF 0   /*readers share the list as long as one is inside, writers can starve*/
+#define RW_WRITER_PREF 1   /*a waiting writer stops new readers from entering*/
+#define RW_FAIR        2   /*readers and writers are served in arrival order*/
+/*the implementations an rw_lock_t can run on*/
+#define RW_BACKEND_SEM     0   /*the protocol on sem_t semaphores*/
+#define RW_BACKEND_PTHREAD 1   /*pthread_rwlock_t, the protocol set with its kind*/
+#define RW_BACKEND_FUTEX   2   /*one atomic state word, sleeping on it with futex*/
+/*the lock of each list unless the -a and -t options pick another one at run time*/
+#ifndef ALARM_LOCK_BACKEND
+#define ALARM_LOCK_BACKEND RW_BACKEND_FUTEX
+#endif
+#ifndef ALARM_LOCK_POLICY
+#define ALARM_LOCK_POLICY RW_READER_PREF
+#endif
+#ifndef THREAD_LOCK_BACKEND
+#define THREAD_LOCK_BACKEND RW_BACKEND_FUTEX
+#endif
+#ifndef THREAD_LOCK_POLICY
+#define THREAD_LOCK_POLICY RW_READER_PREF
+#endif
+/*compile with -DLOCK_PROFILE to keep wait and hold time histograms and
+the busiest call sites of every rw_lock_t, without it none of that code
+or data exists*/
+/*selects the expiry engine: the hierarchical timing wheel when it is not
+0, the alarm_heap when compiled with -DTIMING_WHEEL=0*/
+#ifndef TIMING_WHEEL
+#define TIMING_WHEEL 1
+#endif
+/*how the program is driven*/
+#define RUNTIME_THREADS 0   /*alarm_thread, a pool of display workers and a writer thread per request*/
+#define RUNTIME_EPOLL   1   /*one epoll loop in main services input, expiry and display*/
+/*the runtime used unless the -e option picks the other one at run time*/
+#ifndef ALARM_RUNTIME
+#define ALARM_RUNTIME RUNTIME_THREADS
+#endif
+/*the implementations of the alarm store*/
+#define STORE_LOCKED   0   /*each shard's list and indexes are guarded by the shard lock*/
+#define STORE_LOCKFREE 1   /*each shard is one lock-free ordered list*/
+/*the store used unless the -m option picks the other one at run time*/
+#ifndef ALARM_STORE
+#define ALARM_STORE STORE_LOCKED
+#endif
+
+/*The link of an object handed to the epoch reclaimer. it is embedded in
+every object a lock-free reader may still be looking at when a writer
+unlinks it, reclaim frees the object once no reader can see it*/
+typedef struct rcu_head_tag {
+    struct rcu_head_tag *next;
+    unsigned long       epoch;      /*rcu_epoch when the object was retired*/
+    void                (*reclaim)(struct rcu_head_tag *head);
+} rcu_head_t;
+
+/*A thread's announcement to the reclaimer, state is 0 outside a read
+section and (epoch << 1) | 1 inside one. records are never freed, the
+record of a finished thread is reused by the next reader thread*/
+typedef struct rcu_reader_tag {
+    struct rcu_reader_tag *next;
+    unsigned long       state;
+    int                 depth;      /*nesting of read sections, only its own thread touches it*/
+    int                 in_use;
+} __attribute__ ((aligned (64))) rcu_reader_t;
+
+/*The cold part of a Type A alarm request, it is only read when the alarm
+is printed. It is a length-prefixed block of the message arena that is
+just big enough for its own message*/
+typedef struct alarm_payload_tag {
+  int                 seconds;
+  unsigned short      milliseconds; /*the fraction of a second of the duration*/
+  unsigned short      size_class;  /*the arena free list the block goes back to*/
+  unsigned short      length;      /*strlen of message*/
+  /*a freed block keeps its free list link in message, so it is
+  pointer aligned*/
+  char                message[] __attribute__ ((aligned (sizeof(void *))));   /*length + 1 bytes*/
+} alarm_payload_t;
+
+/*the lifecycle of an alarm. it starts ALARM_PENDING, the first display
+moves it to ALARM_DISPLAYING and it ends in one of the other three.
+every change is a compare-and-swap on the alarm's state, so it needs
+no writer lock and every thread sees it at once*/
+#define ALARM_PENDING    0   /*in the store, not displayed yet*/
+#define ALARM_DISPLAYING 1   /*a display has printed it*/
+#define ALARM_EXPIRED    2   /*its time has passed, waiting to be swept*/
+#define ALARM_CANCELLED  3   /*a Type C request for its number is queued*/
+#define ALARM_REPLACED   4   /*a newer alarm with the same number took its place*/
+#define ALARM_LIVE(state)   ((state) <= ALARM_DISPLAYING)
+#define ALARM_STATE(alarm)  __atomic_load_n(&(alarm)->state, __ATOMIC_ACQUIRE)
+
+/*A linked list structure that holds the information about the Type A alarm requests.
+The fields every scan reads come first and fit in the first 64 byte cache
+line of the node, the message is stored out of line in alarm_payload_t*/
 typedef struct alarm_tag {
   struct alarm_tag    *link;
-  int                 seconds;
-  time_t              time;
-  char                message[128];
+  struct alarm_tag    *type_next;    /*next alarm in the bucket of the same message type*/
+  long                deadline;      /*CLOCK_MONOTONIC nanoseconds at which the alarm expires*/
   int                 number;
   int                 type;           /* type of message*/
-  int                 is_done;     /*if alarm time has expired is_done = 1, else = 0*/
-} alarm_t;
-
-/*A linked list structure that holds information about a thread and the
-type of alarm request it manages*/
+  int                 state;       /*one of the ALARM_ states, only changed atomically*/
+  int                 heap_index;  /*position of the alarm in alarm_heap, -1 if it is not in the heap*/
+  struct type_bucket_tag *bucket;    /*the bucket of this alarm's message type*/
+  alarm_payload_t     *payload;      /*duration and message, kept out of line*/
+  /*index links, only touched when the alarm is inserted, replaced or removed*/
+  struct alarm_tag    **pprev;     /*the link field in alarm_list that points to this alarm*/
+  struct alarm_tag    **type_pprev;  /*link in the bucket that points to this alarm*/
+  struct alarm_tag    *wheel_next;   /*next alarm in the same timing wheel slot*/
+  struct alarm_tag    **wheel_pprev; /*link that points to this alarm, NULL if it is not in the wheel*/
+  rcu_head_t          rcu;           /*used once the alarm is retired*/
+} __attribute__ ((aligned (64))) alarm_t;
+
+/*the lock-free store marks an alarm as deleted in the low bit of its
+link, alarm_t is aligned so the bit is otherwise always 0*/
+#define LINK_MARK          1UL
+#define LINK_MARKED(link)  ((unsigned long) (link) & LINK_MARK)
+#define LINK_PTR(link)     ((alarm_t *) ((unsigned long) (link) & ~LINK_MARK))
+
+/*A bucket that holds every alarm of one message type, so a periodic display
+thread only walks its own alarms*/
+typedef struct type_bucket_tag {
+    struct type_bucket_tag  *link;    /*next bucket in the same type_buckets chain*/
+    int                     type;
+    int                     active;   /*number of alarms in the bucket that are not done, changed atomically*/
+    alarm_t                 *alarms;  /*alarms of this type in message number order*/
+    alarm_t                 **tail;   /*link field of the last alarm, or &alarms*/
+    rcu_head_t              rcu;      /*used once the bucket is retired*/
+} type_bucket_t;
+
+/*The slot array of a key table. capacity is a power of two and lives in
+the array, so a reader always probes an array with its own size*/
+typedef struct key_slots_tag {
+    int                     capacity;
+    void                    *slots[];
+} key_slots_t;
+
+/*An open-addressing hash table (linear probing) of nodes keyed by an int
+field of the node, key_offset is where that field is. entries never move
+inside an array: a deletion leaves KEY_TOMBSTONE in its slot, and the
+tombstones are dropped when the table is rebuilt into a new array that
+is published with RCU. so a lookup never has to retry*/
+typedef struct key_table_tag {
+    key_slots_t             *array;
+    int                     count;      /*live entries*/
+    int                     used;       /*live entries and tombstones*/
+    size_t                  key_offset;
+} key_table_t;
+
+/*A structure that holds information about a thread and the type of alarm
+request it manages, it is an entry of the dense thread_list array*/
 typedef struct thread_data_structure {
-    struct thread_data_structure     *link;    
     int				                 type;
     int                              is_created;
+    int                              position;  /*index of this entry in thread_list*/
     // int                              flag; /* used to terminate the while loop in the thread so the thread exits safely*/
 } thread_ds;
 
-/*a linked list pestructure that holds information abou the messages sheduled to be
+/*a node of the removal_queue that holds information abou the messages sheduled to be
 deleted*/
 typedef struct message_removal_data_structure {
     struct message_removal_data_structure     *link;
     int  			                           number;    
 } removal_ds;
 
-/*Initial instantiations of the linked lists*/
-alarm_t *alarm_list = NULL;
-thread_ds *thread_list = NULL;
-removal_ds *removal_list = NULL;
+/*indexes of the semaphores of the readers-writers protocol*/
+#define RW_COUNT_ACCESS       0   /*guards readCount*/
+#define RW_RESOURCE           1   /*held by the writer, or by the readers as a group*/
+#define RW_READ_TRY           2   /*writer-preferring: held by the writers while any writer waits*/
+#define RW_WRITE_COUNT_ACCESS 3   /*writer-preferring: guards writeCount*/
+#define RW_SERVICE_QUEUE      4   /*fair: every reader and writer queues here first*/
+#define RW_SEMAPHORES         5
+
+/*the bits of the state word of the futex backend, the rest of the word
+counts the readers inside in RW_READER steps*/
+#define RW_WRITER         1u   /*a writer holds the lock*/
+#define RW_WAITERS        2u   /*a thread may be sleeping on the word*/
+#define RW_WRITER_WAITING 4u   /*writer-preferring: a writer waits, new readers stay out*/
+#define RW_READER         8u
+
+#ifdef LOCK_PROFILE
+#define PROFILE_BUCKETS 24   /*bucket 0 is under 1 us, bucket i up to 2^i us*/
+#define PROFILE_SITES   32   /*call sites kept per lock, the rest are counted as other*/
+#define PROFILE_TOP     5    /*call sites printed per lock*/
+#define PROFILE_HOLDS   8    /*locks one thread can hold at once and still be timed*/
+
+/*one place in the code that takes a lock*/
+typedef struct lock_site_tag {
+    const char          *function;  /*__func__ of the caller, NULL while the slot is free*/
+    int                 line;       /*stored last by the claimer, 0 until kind is set*/
+    int                 kind;       /*0 for a reader and 1 for a writer*/
+    long                count;
+    long                wait_ns;
+} lock_site_t;
+
+/*the histograms of a lock, indexed by kind like the statistics of rw_lock_t*/
+typedef struct lock_profile_tag {
+    long                wait_hist[2][PROFILE_BUCKETS];
+    long                hold_hist[2][PROFILE_BUCKETS];
+    lock_site_t         sites[PROFILE_SITES];
+    long                other_sites;
+} lock_profile_t;
+#endif
+
+/*An instrumented readers-writers lock. the sem backend runs the
+protocol (policy) on sems, the futex backend keeps everything in state
+and the pthread backend hands everything to rwlock. index 0 of the
+statistics is for readers and index 1 for writers. acquisitions are
+counted in the calling thread's rw_counts_t so an uncontended entry stays
+a single atomic on the lock, the rest are updated atomically*/
+typedef struct rw_lock_tag {
+    const char          *name;
+    int                 slot;       /*its acquisitions in rw_counts_t, + 1, 0 until first initialized*/
+    int                 backend;    /*one of the RW_BACKEND_ values*/
+    int                 policy;     /*one of RW_READER_PREF, RW_WRITER_PREF, RW_FAIR*/
+    sem_t               sems[RW_SEMAPHORES];
+    unsigned int        state;
+    pthread_rwlock_t    rwlock;
+    int                 readCount;  /*readers inside or entering*/
+    int                 writeCount; /*writers waiting for or holding the lock*/
+    long                contended[2];   /*acquisitions that had to wait*/
+    long                wait_ns[2];     /*total time spent waiting*/
+#ifdef LOCK_PROFILE
+    lock_profile_t      profile;
+#endif
+} rw_lock_t;
+
+/*The statistics of a semaphore or mutex that is not an rw_lock_t, such as
+arenaAccess or alarm_mutex. it is exclusive, so it is counted like the
+writer side of an rw_lock_t*/
+typedef struct lock_stats_tag {
+    const char          *name;
+    long                acquisitions;
+    long                contended;      /*acquisitions that had to wait*/
+    long                wait_ns;        /*total time spent waiting*/
+#ifdef LOCK_PROFILE
+    lock_profile_t      profile;
+#endif
+} lock_stats_t;
+
+/*the fixed-size node types that are allocated from object pools*/
+#define POOL_ALARM    0
+#define POOL_THREAD   1
+#define POOL_REMOVAL  2
+#define POOL_BUCKET   3
+#define POOL_COUNT    4
+
+/*number of objects moved between a thread's cache and its pool at once*/
+#define POOL_BATCH      32
+/*bytes carved out of the general-purpose allocator each time a pool runs dry*/
+#define POOL_SLAB_SIZE  16384
+/*every object_size is rounded up to this, so each object in a slab is
+aligned for the free list link and for any field of its type*/
+#define POOL_ALIGN      __alignof__(max_align_t)
+
+/*A slab pool of fixed-size objects. Slabs are cache line aligned and never given back, freed
+objects are kept on free_list (linked through their first bytes) and
+handed out again, so the steady state never calls malloc or free*/
+typedef struct object_pool_tag {
+    const char      *name;
+    size_t          object_size;
+    sem_t           access;      /*guards free_list and slab carving*/
+    void            *free_list;
+    int             slabs;
+    int             live;        /*objects handed out and not yet returned*/
+    int             high_water;  /*the most objects that were ever live at once*/
+    lock_stats_t    stats;       /*of access*/
+} object_pool_t;
+
+/*A per-thread cache of free objects for one pool, so most allocations
+and frees never touch the pool's semaphore*/
+typedef struct pool_cache_tag {
+    void            *free_list;
+    int             count;
+} pool_cache_t;
+
+/*the object pools and each thread's caches of them*/
+object_pool_t pools[POOL_COUNT] = {
+    {"alarm_t",    sizeof(alarm_t)},
+    {"thread_ds",  sizeof(thread_ds)},
+    {"removal_ds", sizeof(removal_ds)},
+    {"type_bucket_t", sizeof(type_bucket_t)}
+};
+__thread pool_cache_t pool_caches[POOL_COUNT];
+/*its destructor hands a finishing thread's caches back to the pools*/
+pthread_key_t pool_cache_key;
+
+/*the message arena. payloads are carved from ARENA_CHUNK_SIZE chunks in
+ARENA_ALIGN steps, a freed payload goes onto the free list of its size
+class and is reused by the next message of the same size class*/
+#define ARENA_ALIGN       16
+#define ARENA_CHUNK_SIZE  65536
+#define ARENA_MAX_BLOCK   2048
+#define ARENA_CLASSES     (ARENA_MAX_BLOCK / ARENA_ALIGN)
+sem_t   arenaAccess;
+lock_stats_t arena_stats = {"arenaAccess"};
+char    *arena_chunk = NULL;       /*chunk that new blocks are carved from*/
+size_t  arena_chunk_used = ARENA_CHUNK_SIZE;
+alarm_payload_t *arena_free[ARENA_CLASSES + 1];
+int     arena_chunks = 0;
+long    arena_bytes_live = 0;      /*bytes of the blocks handed out*/
+long    arena_blocks_live = 0;
+
+/*the Type C requests waiting for alarm_thread, a lock-free multi-producer
+single-consumer queue. producers push onto the head with one atomic
+exchange, alarm_thread takes the whole queue with another one. a node's
+link reads REMOVAL_LINK_PENDING for the instant between its producer's
+exchange and the store of its link*/
+#define REMOVAL_LINK_PENDING ((removal_ds *) 1)
+removal_ds *removal_queue = NULL;
+
+/*message types whose active alarm count dropped to zero, queued for
+alarm_thread to reap their display thread. it is the same kind of queue
+as removal_queue, the number of each node holds a message type*/
+removal_ds *reap_queue = NULL;
+
+/*the registry of periodic display threads. thread_list is a dense array of
+the registered threads (a removal moves the last entry into the hole).
+a message type below THREAD_DENSE_TYPES finds its entry through
+thread_slots, a bigger (sparse) type through the thread_table key table.
+thread_active has one bit per registered dense type and is read without
+thread_list_lock*/
+#define THREAD_DENSE_TYPES 65536
+#define BITS_PER_WORD      (8 * sizeof(unsigned long))
+thread_ds **thread_list = NULL;
+int   thread_count = 0;
+int   thread_capacity = 0;
+thread_ds *thread_slots[THREAD_DENSE_TYPES];
+key_table_t thread_table = {NULL, 0, 0, offsetof(thread_ds, type)};
+unsigned long thread_active[THREAD_DENSE_TYPES / BITS_PER_WORD];
+
+/*the timing wheel of a shard owns every pending alarm by deadline. it
+ticks once per millisecond of CLOCK_MONOTONIC: level 0 has one slot per
+millisecond, level 1 one per second, level 2 one per minute, level 3 one
+per hour and level 4 one per day. alarms further away than the top level
+wait in wheel_overflow, alarms that are due wait in wheel_due*/
+#define WHEEL_LEVELS    5
+#define WHEEL_MAX_SLOTS 1000
+int     wheel_slots[WHEEL_LEVELS] = {1000, 60, 60, 24, 366};
+long    wheel_span[WHEEL_LEVELS]  = {1, 1000, 60 * 1000L, 60 * 60 * 1000L, 24 * 60 * 60 * 1000L}; /*milliseconds covered by one slot*/
+
+/*alarm_list is split by message number into alarm_shard_count shards.
+an alarm and every index of it live in one shard and are guarded by the
+shard's lock, so writers of different shards never wait for each other.
+listings and per type scans visit every shard*/
+#define ALARM_SHARDS_MAX 64
+#ifndef ALARM_SHARDS
+#define ALARM_SHARDS 8
+#endif
+typedef struct alarm_shard_tag {
+    rw_lock_t       lock;
+    alarm_t         *list;            /*the shard's alarms ordered by message number*/
+    /*the alarms of list keyed by alarm_t->number, so an alarm can be
+    found without walking list*/
+    key_table_t     table;
+    /*number of alarms that are done but still linked into list, it lets
+    the sweep skip the lock when nothing has expired*/
+    int             done_count;
+    /*a chained hash table of the per message type buckets, keyed by type.
+    bucket_sequence is odd while bucket_grow relinks the chains*/
+    type_bucket_t   **buckets;
+    int             bucket_capacity;
+    int             bucket_count;
+    unsigned int    bucket_sequence;
+    /*a binary min-heap ordered by alarm_t->deadline of every pending
+    alarm, so the earliest deadline is always at heap[0]*/
+    alarm_t         **heap;
+    int             heap_size;
+    int             heap_capacity;
+    /*Type A writer threads of the shard that have not finished their
+    insert, a futex word. consecutive Type A requests of different
+    shards are inserted at the same time. a request of the same shard
+    waits for it to reach 0, so two requests for one message number are
+    applied in the order they were typed, and so does a Type B or C
+    request for every shard*/
+    unsigned int    inserts_running;
+    /*the hierarchical timing wheel*/
+    alarm_t         *wheel[WHEEL_LEVELS][WHEEL_MAX_SLOTS];
+    alarm_t         *wheel_overflow;
+    alarm_t         *wheel_due;
+    long            wheel_time;       /*every millisecond tick up to and including wheel_time has been processed*/
+    int             wheel_size;       /*alarms in the wheel, an empty wheel is not ticked*/
+} alarm_shard_t;
+
+/*A thread's acquisition counts of every rw_lock_t, indexed by its slot.
+only its own thread writes them, prt_rw_lock sums all of them. like the
+rcu_reader_t records they are never freed, the record of a finished
+thread is reused by the next one and keeps its counts*/
+#define RW_LOCKS_MAX    (ALARM_SHARDS_MAX + 2)   /*the shards, thread_list_lock and bench_lock*/
+typedef struct rw_counts_tag {
+    struct rw_counts_tag *next;
+    int                 in_use;
+    long                acquisitions[RW_LOCKS_MAX][2];
+} __attribute__ ((aligned (64))) rw_counts_t;
+
+alarm_shard_t alarm_shards[ALARM_SHARDS_MAX];
+int   alarm_shard_count = ALARM_SHARDS;
+/*the store in use, one of the STORE_ values. with STORE_LOCKFREE only
+the list of each shard is used, every scan walks it*/
+int   alarm_store = ALARM_STORE;
+
+/*the lock of thread_list*/
+rw_lock_t thread_list_lock;
+int rw_lock_slots = 0;                   /*slots handed out to rw_lock_t*/
+rw_counts_t *rw_counts_list = NULL;      /*every count record ever created*/
+__thread rw_counts_t *rw_counts_self = NULL;
+pthread_key_t rw_counts_key;
+pthread_once_t rw_counts_once = PTHREAD_ONCE_INIT;
+
+/*alarm_thread waits on alarm_cond until the next alarm is due or a
+producer hands it work. alarm_work is set by the producers,
+current_alarm is the CLOCK_MONOTONIC deadline in nanoseconds
+alarm_thread waits for, 0 if none. both are guarded by alarm_mutex.
+alarm_cond is set up on CLOCK_MONOTONIC in main*/
+pthread_mutex_t alarm_mutex = PTHREAD_MUTEX_INITIALIZER;
+lock_stats_t    alarm_mutex_stats = {"alarm_mutex"};
+pthread_cond_t  alarm_cond;
+int     alarm_work = 0;
+long    current_alarm = 0;
+/*the runtime in use, one of the RUNTIME_ values*/
+int     alarm_runtime = ALARM_RUNTIME;
+
+/*the displays of RUNTIME_THREADS. a fixed pool of display workers, one
+per core, displays every created type, so the thread count does not grow
+with the number of types. each type is a job, a removal_ds node whose
+number holds the type like the nodes of reap_queue. a job waits in
+display_parked until display_tick_thread moves it to the display_run
+queue on a whole DISPLAY_PERIOD_NS of CLOCK_MONOTONIC, a worker takes it
+from there, displays the type and parks it again. the lists are guarded
+by display_mutex. display_jobs counts the jobs, it is a futex word the
+tick sleeps on while it is 0*/
+#define DISPLAY_PERIOD_NS   1000000000L
+#define DISPLAY_WORKERS_MAX 64
+pthread_mutex_t display_mutex = PTHREAD_MUTEX_INITIALIZER;
+lock_stats_t    display_mutex_stats = {"display_mutex"};
+pthread_cond_t  display_cond = PTHREAD_COND_INITIALIZER;
+removal_ds  *display_run = NULL;
+removal_ds **display_run_tail = &display_run;
+removal_ds  *display_parked = NULL;
+unsigned int display_jobs = 0;
+int     display_workers = 0;
+
+/*epoch based reclamation. readers of alarm_list and its indexes run in
+read sections instead of taking the shard locks, writers retire what
+they unlink and alarm_thread frees it two epochs later*/
+unsigned long rcu_epoch = 0;
+rcu_reader_t *rcu_readers = NULL;        /*every reader record ever created*/
+__thread rcu_reader_t *rcu_self = NULL;
+/*its destructor gives a finishing thread's record back*/
+pthread_key_t rcu_reader_key;
+rcu_head_t *rcu_retired = NULL;          /*objects waiting for their grace period*/
+long  rcu_retired_count = 0;
+long  rcu_reclaimed_count = 0;
 
-/*semaphores for alarm_list declared here*/
-sem_t readCountAccess;
-sem_t alarmListAccess;
-/*a counter for the number of readers currently reading the alarm_list*/
-int   readCount=0;
-
-/*semaphores for thread_list*/
-sem_t t_readCountAccess;
-sem_t t_threadListAccess;
-/*a counter for the number of readers currently reading the thread_list*/
-int   t_readCount=0;
-
-/*semaphores for removal_list*/
-sem_t r_readCountAccess;
-sem_t r_threadListAccess;
-/*a counter for the number of readers currently reading the removal_list*/
-int   r_readCount=0;
 
 /*<><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><>*/
 /*<><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><>  FUNCTION DEFINITIONS*/
@@ -81,6 +489,15 @@ msg_number : the message number of the alarm
 print_msg : prints 2 types of messages whether the print_msg=0 or
             less than zero*/ 
 void remove_from_alarm_list(int msg_number, int print_msg);
+
+/*removes the alarms of every message number in a batch of Type C
+requests in one pass, under a single lock of the alarm_list*/
+void remove_batch_from_alarm_list(removal_ds *batch);
+
+/*unlinks an alarm from its shard and every index of it, an alarm that
+is still live is settled as cancelled. it assumes the shard has been
+locked for writing before call*/
+void alarm_detach(alarm_shard_t *shard, alarm_t *alarm);
 /*adds Type A alarm requests to the alarm_list:
 parameter: arg is an struct alarm_t*/
 void * add_to_alarm_list (void * arg);
@@ -88,11 +505,51 @@ void * add_to_alarm_list (void * arg);
 /*it prints the content of the alarm_list*/
 void prt_alarm_list();
 
-/*the semaphore lock for the reader functions*/
-void alarm_reader_semaphore_lock();
+/*gives an alarm and its payload back to the alarm pool and message arena*/
+void alarm_free(alarm_t *alarm);
+
+/*hands an alarm that has been detached to the epoch reclaimer, it is
+given to alarm_free once no reader can still see it*/
+void alarm_retire(alarm_t *alarm);
+
+/*returns the shard that holds, or would hold, a message number*/
+alarm_shard_t * alarm_shard(int msg_number);
+
+/*returns a new alarm from the alarm pool and message arena*/
+alarm_t * alarm_create(long duration_ms, int msg_type, int msg_number, const char *message);
+
+/*parses a Type A duration, whole seconds with an optional fraction of up
+to three digits such as "2" or "0.250". returns the milliseconds, or -1
+if the text is no duration*/
+long parse_duration_ms(const char *text);
+
+/*adds an alarm to the store in use, replacing the alarm of the same
+message number. returns 1 and sets *replaced_type if it replaced one*/
+int store_insert(alarm_t *alarm, int *replaced_type);
+
+/*removes the alarm of a message number from the store in use, returns 1
+if there was one*/
+int store_remove(int msg_number);
+
+/*returns the alarm of a message number or NULL, it must be called in a
+read section*/
+alarm_t * store_find(int msg_number);
+
+/*walk the alarms of one message type in a shard, they must be called
+in a read section*/
+alarm_t * scan_type_first(alarm_shard_t *shard, int msg_type);
+alarm_t * scan_type_next(alarm_t *alarm);
 
-/*the semaphore release for the reader functions*/
-void alarm_reader_semaphore_release();
+/*initializes the locks and key tables of the shards, called once from main*/
+void alarm_shards_init();
+
+/*measures how long writers wait for the alarm_list under a mixed
+read/write load, for every lock backend and protocol, and prints the results*/
+void alarm_lock_benchmark();
+
+/*measures the insert and remove throughput of both stores for a
+growing number of producer threads and prints the results*/
+void alarm_store_benchmark();
 
 /*returns positive number if the alarm specified exists, 
 else returns 0. parameters are:
@@ -101,9 +558,128 @@ type : specifies to the method whether to search alarm using message_number (1)
 and message_type(0)*/
 int alarm_exists(int msg_id, int type);
 
-/*removes all alarms that are expired*/
+/*removes all alarms that are expired in a single sweep of alarm_list*/
 void remove_alarms_that_are_done();
 
+/*pops every alarm whose time has passed off the alarm_heap and
+marks it as done*/
+void expire_alarms_that_are_due();
+
+/*<><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><>*/
+/*lock-free alarm list function definitions, the Harris ordered list of
+STORE_LOCKFREE. a deleted alarm is marked in its link before it is
+unlinked, all of them must be called in a read section*/
+
+/*returns the first live alarm whose number is at least key and sets
+*prev to the link that points to it. marked alarms on the way are
+unlinked and retired*/
+alarm_t * lf_search(alarm_shard_t *shard, long key, alarm_t ***prev);
+
+/*returns the live alarm of a message number or NULL, it never writes*/
+alarm_t * lf_find(alarm_shard_t *shard, int msg_number);
+
+/*walk the live alarms of a shard in message number order*/
+alarm_t * lf_first(alarm_shard_t *shard);
+alarm_t * lf_next(alarm_t *alarm);
+
+/*links an alarm in, replacing the alarm of the same number. returns 1
+and sets *replaced_type if it replaced one*/
+int lf_insert(alarm_shard_t *shard, alarm_t *alarm, int *replaced_type);
+
+/*deletes the alarm of a message number, returns 1 if there was one*/
+int lf_remove(alarm_shard_t *shard, int msg_number);
+
+/*<><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><>*/
+/*key table function definitions, key_table_find may be called in a read
+section or with the table's list locked, the others need it locked for
+writing*/
+
+/*returns the node with the key, or NULL if there is none. it does not
+block on the table lock and never retries*/
+void * key_table_find(key_table_t *table, int key);
+
+/*adds a node into the table, or overwrites the entry of the node with
+the same key*/
+void key_table_insert(key_table_t *table, void *node);
+
+/*removes the node with the key from the table, leaving a tombstone*/
+void key_table_remove(key_table_t *table, int key);
+
+/*<><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><>*/
+/*type bucket function definitions, bucket_find may be called in a read
+section or with the alarm_list locked, the others need it locked for writing*/
+
+/*returns the bucket of a message type, or NULL if no alarm has the type.
+it yields while bucket_grow relinks the chains*/
+type_bucket_t * bucket_find(alarm_shard_t *shard, int msg_type);
+
+/*appends an alarm to the bucket of its type, creating the bucket if needed*/
+void bucket_add(alarm_shard_t *shard, alarm_t *alarm);
+
+/*unlinks an alarm from its bucket, the bucket is freed once it is empty*/
+void bucket_remove(alarm_shard_t *shard, alarm_t *alarm);
+
+/*marks an alarm as expired and counts it in the shard's done_count,
+returns 0 if the alarm was no longer live*/
+int alarm_mark_done(alarm_shard_t *shard, alarm_t *alarm);
+
+/*moves a live alarm to one of the final states and takes it out of its
+bucket's active count. returns 0 if the alarm had already left the live
+states. with STORE_LOCKED the caller holds the shard lock, for reading
+at least, so the alarm's bucket stays put*/
+int alarm_settle(alarm_t *alarm, int state);
+
+/*<><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><>*/
+/*alarm_heap function definitions, all of them assume the alarm_list
+has been locked for writing before the call*/
+
+/*adds an alarm into alarm_heap in O(log n)*/
+void heap_insert(alarm_shard_t *shard, alarm_t *alarm);
+
+/*removes an alarm from anywhere in the alarm_heap in O(log n) using
+its heap_index, does nothing if the alarm is not in the heap*/
+void heap_remove(alarm_shard_t *shard, alarm_t *alarm);
+
+/*returns the alarm with the earliest time without removing it,
+or NULL if the heap is empty*/
+alarm_t * heap_peek(alarm_shard_t *shard);
+
+/*<><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><>*/
+/*timing wheel function definitions, all of them assume the alarm_list
+has been locked for writing before the call*/
+
+/*files an alarm into the wheel slot of its deadline in O(1)*/
+void wheel_insert(alarm_shard_t *shard, alarm_t *alarm);
+
+/*unlinks an alarm from whichever slot holds it in O(1), does nothing
+if the alarm is not in the wheel*/
+void wheel_remove(alarm_t *alarm);
+
+/*moves the wheel up to now (milliseconds), cascading the upper levels
+and moving the alarms of each level 0 slot onto wheel_due. it only
+stops on the ticks that have something to do*/
+void wheel_advance(alarm_shard_t *shard, long now);
+
+/*<><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><>*/
+/*expiry engine function definitions. they forward to the timing wheel
+or the alarm_heap depending on TIMING_WHEEL and assume the alarm_list
+has been locked for writing before the call*/
+
+/*starts tracking the deadline of an alarm*/
+void expiry_schedule(alarm_shard_t *shard, alarm_t *alarm);
+
+/*stops tracking the deadline of an alarm that is replaced or removed*/
+void expiry_cancel(alarm_shard_t *shard, alarm_t *alarm);
+
+/*removes and returns one alarm whose deadline has been reached at now
+(CLOCK_MONOTONIC nanoseconds), or NULL when no alarm is due*/
+alarm_t * expiry_next_due(alarm_shard_t *shard, long now);
+
+/*returns the CLOCK_MONOTONIC nanosecond at which expiry_next_due will
+next hand out an alarm, 0 if nothing is scheduled. the shard only has
+to be locked for reading*/
+long expiry_next_deadline(alarm_shard_t *shard);
+
 /*<><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><>*/
 /*thread_list function definitions*/
 
@@ -117,15 +693,14 @@ void remove_from_thread_list(int msg_type);
 /*prints information about all the currently running thread*/
 void prt_thread_list();
 
-/*readers' semaphore lock for thread_list*/
-void thread_reader_semaphore_lock();
-
-/*readers' semaphore unlock for thread_list*/
-void thread_reader_semaphore_release();
+/*returns the thread_list entry of a message type or NULL, it
+assumes thread_list has been locked before call*/
+thread_ds * thread_find(int msg_type);
 
 /*checks the thread_list if an element with a 
 message_type exists. returns positive number if thread
-exists, else returns 0*/
+exists, else returns 0. dense types are checked in the
+thread_active bitmap without taking thread_list_lock*/
 int thread_exists(int msg_type);
 
 /*it checks if the thread specified by the message_type
@@ -138,36 +713,138 @@ the message_types specified in the thread_list*/
 void check_thread_list_and_create_thread();
 
 /*removes a thread from the threadlist if the thread
-has no active alarms*/
+has no active alarms. only the types queued on reap_queue
+are checked*/
 void remove_threads_if_no_active_alarm();
 
+/*queues a message type for remove_threads_if_no_active_alarm
+to check*/
+void queue_thread_reap(int msg_type);
+
 /*<><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><>*/
-/*functions for editing removal_list*/
+/*functions for the removal_queue*/
 
-/*adds a Type C alarm request into the removal_list.
-it takes in the message_number of the Type A alarm request*/
-void add_to_removal_list(int msg_number);
+/*pushes a node onto a removal_queue style queue, it never blocks*/
+void mpsc_push(removal_ds **queue, removal_ds *node);
+
+/*takes every node off a removal_queue style queue with one atomic
+exchange and returns them in the order they were pushed*/
+removal_ds * mpsc_take_all(removal_ds **queue);
 
-/*removes a Type C request from the removal_list*/
-/*void remove_from_removal_list(int msg_number);*/
+/*adds a Type C alarm request into the removal_queue and marks the
+alarm as having a pending cancel. it takes in the message_number of the
+Type A alarm request. it takes no lock, the lookup only yields while the
+shard's table grows or moves entries*/
+void add_to_removal_list(int msg_number);
 
-/*returns positive number if the removal request exists
-in the removal list*/
+/*returns positive number if a removal request for the message
+number is already queued*/
 int remove_request_exists(int msg_number);
 
-/*prints out all the Type C alarm requests*/
-void prt_removal_list();
+/*prints out the Type C alarm requests of a drained batch*/
+void prt_removal_list(removal_ds *batch);
 
-/*semaphore lock for the reader functions of the
-removal list*/
-void removal_reader_semaphore_lock();
+/*removes all the Type A alarms in the removal queue, only
+alarm_thread calls it*/
+void remove_alarms_in_removal_list();
 
-/*semaphore unlock for the reader functions of the 
-removal list*/
-void removal_reader_semaphore_release();
+/*<><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><>*/
+/*readers-writers lock function definitions*/
+
+/*initializes a lock on a backend and protocol and clears its statistics*/
+void rw_lock_init(rw_lock_t *lock, const char *name, int backend, int policy);
+
+/*re-initializes an idle lock from a "backend[:policy]" string such as
+"futex:fair", returns 0 if the string names no backend or protocol*/
+int rw_lock_configure(rw_lock_t *lock, const char *spec);
+
+/*shared lock for the reader functions*/
+void rw_read_lock(rw_lock_t *lock);
+void rw_read_unlock(rw_lock_t *lock);
+
+/*exclusive lock for the writer functions*/
+void rw_write_lock(rw_lock_t *lock);
+void rw_write_unlock(rw_lock_t *lock);
+
+/*take and release a semaphore or mutex that is not an rw_lock_t and
+count it in stats the way an rw_lock_t counts its writers. the
+lock_sem_wait and lock_mutex_lock macros pass the call site*/
+void lock_sem_wait_at(sem_t *sem, lock_stats_t *stats, const char *function, int line);
+void lock_sem_post(sem_t *sem, lock_stats_t *stats);
+void lock_mutex_lock_at(pthread_mutex_t *mutex, lock_stats_t *stats, const char *function, int line);
+void lock_mutex_unlock(pthread_mutex_t *mutex, lock_stats_t *stats);
+#define lock_sem_wait(sem, stats)     lock_sem_wait_at((sem), (stats), __func__, __LINE__)
+#define lock_mutex_lock(mutex, stats) lock_mutex_lock_at((mutex), (stats), __func__, __LINE__)
+
+/*waits on cond with a mutex taken by lock_mutex_lock, until abstime or
+without a timeout when it is NULL. returns what pthread_cond_timedwait
+or pthread_cond_wait return, the mutex does not count as held meanwhile*/
+int lock_cond_wait(pthread_cond_t *cond, pthread_mutex_t *mutex, lock_stats_t *stats,
+                   const struct timespec *abstime);
+
+/*prints the acquisitions, contended acquisitions and wait time of
+the shard locks, thread_list_lock and the counted semaphores and
+mutexes, with LOCK_PROFILE also their histograms and busiest call sites*/
+void prt_lock_stats();
+
+#ifdef LOCK_PROFILE
+/*called by the lock macros at the end of the section after an acquire
+and before a release, they record the call site and hold time in the
+profile of an rw_lock_t or lock_stats_t*/
+void profile_acquired(lock_profile_t *profile, int kind, const char *function, int line);
+void profile_release(lock_profile_t *profile, int kind);
+
+/*starts timing a hold of the lock without counting an acquisition*/
+void profile_hold(lock_profile_t *profile);
+#endif
 
-/*removes all the Type A alarms in the removal list*/
-void remove_alarms_in_removal_list();
+/*<><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><>*/
+/*epoch reclamation function definitions*/
+
+/*creates the reader record key, called once from main*/
+void rcu_init();
+
+/*starts a read section, every object reachable from alarm_list and its
+indexes stays allocated until the matching rcu_read_unlock. it never
+blocks and can be nested*/
+void rcu_read_lock();
+void rcu_read_unlock();
+
+/*hands an object that no longer is reachable to the reclaimer*/
+void rcu_retire(rcu_head_t *head, void (*reclaim)(rcu_head_t *head));
+
+/*the same for a malloc'd block such as an old hash table array*/
+void rcu_retire_memory(void *block);
+
+/*advances the epoch when every reader has seen the current one and
+reclaims the objects whose grace period is over, only alarm_thread
+calls it*/
+void rcu_reclaim();
+
+/*<><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><>*/
+/*object pool function definitions*/
+
+/*initializes the pools' semaphores, called once from main*/
+void pool_init();
+
+/*returns an object from the pool, parameter is one of the POOL_ ids*/
+void * pool_alloc(int pool_id);
+
+/*gives an object back to the pool it was allocated from*/
+void pool_free(int pool_id, void * object);
+
+/*prints the live objects, high-water mark and slabs of every pool*/
+void prt_pool_stats();
+
+/*<><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><>*/
+/*message arena function definitions*/
+
+/*returns a payload block from the message arena holding the duration
+and a copy of the whole message*/
+alarm_payload_t * payload_create(long duration_ms, const char *message);
+
+/*gives a payload block back to the message arena*/
+void payload_free(alarm_payload_t *payload);
 
 /*<><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><>*/
 /*REQUIRED THREADS*/
@@ -175,130 +852,1394 @@ void remove_alarms_in_removal_list();
     assignment specification document*/
 void * alarm_thread (void *arg);
 
-/*it is a thread that prints out a Type A alarm reques
-every second it is alive*/
-void * periodic_display_threads(void * args);
+/*wakes alarm_thread to process new work right away, called after a
+Type A, B or C request has been handed over*/
+void alarm_thread_wake();
+
+/*returns the earliest CLOCK_MONOTONIC nanosecond at which an alarm of
+any shard is due, 0 if none is. while retired memory waits to be
+reclaimed it returns a second from now at the latest*/
+long alarm_next_deadline();
+
+/*starts the display workers, one per online core up to
+DISPLAY_WORKERS_MAX, and display_tick_thread*/
+void display_workers_start();
+
+/*queues the display job of a newly created type to run right away*/
+void display_job_add(int message_type);
+
+/*a display worker, it takes jobs from display_run and prints the Type A
+alarm requests of their type. a job whose type lost its display ends
+with the termination message*/
+void * display_worker(void * args);
+
+/*the tick source of RUNTIME_THREADS, it moves the parked display jobs to
+display_run once a period, and sleeps while there are none*/
+void * display_tick_thread(void *arg);
+
+/*prints the live alarms of one message type, a display worker calls it
+every second and so does the event loop for every display type*/
+void display_type_alarms(int message_type);
+
+/*runs a writer function such as add_to_alarm_list on a thread of its
+own, or right away on the calling thread with RUNTIME_EPOLL*/
+void start_writer(void * (*writer)(void *), void *arg, const char *what);
+
+/*inserts a Type A alarm on a detached writer thread main does not wait
+for, or right away with RUNTIME_EPOLL. it first waits for the inserts
+still running in the alarm's shard*/
+void start_insert(alarm_t *alarm);
+
+/*the start routine of an insert writer thread*/
+void * insert_writer(void *arg);
+
+/*waits until every insert started so far in a shard has finished*/
+void shard_inserts_wait(alarm_shard_t *shard);
+
+/*waits until every insert started so far has finished*/
+void inserts_wait();
+
+/*parses one line of input and carries out the request in it*/
+void process_command(char *line);
+
+/*the RUNTIME_EPOLL main loop. it waits on the input and on one timerfd
+armed for the earliest alarm or display deadline, it never returns*/
+void event_loop();
 
 
 /*<><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><>*/
-/*<><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><>  TYPE A ALARM_LIST FUNCTIONS*/
+/*<><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><>  OBJECT POOL FUNCTIONS*/
 /*<><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><>*/
-void alarm_reader_semaphore_lock(){
-  sem_wait(&readCountAccess);  
-        readCount++;
-        if(readCount==1) {
-            sem_wait(&alarmListAccess);
-        }  
-  sem_post(&readCountAccess);
+/*moves up to count objects from a thread's cache back onto the pool*/
+static void pool_return(int pool_id, int count){
+    object_pool_t *pool = &pools[pool_id];
+    pool_cache_t *cache = &pool_caches[pool_id];
+    void *object;
+
+    lock_sem_wait(&pool->access, &pool->stats);
+        while(count-- > 0 && cache->free_list != NULL){
+            object = cache->free_list;
+            cache->free_list = *(void **) object;
+            cache->count--;
+            *(void **) object = pool->free_list;
+            pool->free_list = object;
+        }
+    lock_sem_post(&pool->access, &pool->stats);
 }
 
-void alarm_reader_semaphore_release(){    
-  sem_wait(&readCountAccess);
-        
-        readCount--;
+/*pthread_key destructor, runs when a thread that used a cache exits*/
+static void pool_flush_caches(void * arg){
+    int i;
+    for(i = 0; i < POOL_COUNT; i++)
+        pool_return(i, pool_caches[i].count);
+}
+
+void pool_init(){
+    int i;
+    for(i = 0; i < POOL_COUNT; i++){
+        /*thread_ds is 12 bytes, unrounded every other one would be misaligned*/
+        pools[i].object_size = (pools[i].object_size + POOL_ALIGN - 1) & ~(POOL_ALIGN - 1);
+        sem_init(&pools[i].access,0,1);
+        pools[i].stats.name = pools[i].name;
+    }
+    pthread_key_create(&pool_cache_key, pool_flush_caches);
+}
+
+void * pool_alloc(int pool_id){
+    object_pool_t *pool = &pools[pool_id];
+    pool_cache_t *cache = &pool_caches[pool_id];
+    void *object;
+    char *slab;
+    int live, high, i;
+
+    if(cache->free_list == NULL){
+        /*refill the cache with a batch, carving a new slab if the pool is dry*/
+        pthread_setspecific(pool_cache_key, pool_caches);
+        lock_sem_wait(&pool->access, &pool->stats);
+            if(pool->free_list == NULL){
+                /*objects whose size is a multiple of 64 (alarm_t) then never
+                straddle a cache line*/
+                if (posix_memalign((void **) &slab, 64, POOL_SLAB_SIZE) != 0)
+                    errno_abort ("Allocate pool slab");
+                for(i = 0; i + pool->object_size <= POOL_SLAB_SIZE; i += pool->object_size){
+                    *(void **) (slab + i) = pool->free_list;
+                    pool->free_list = slab + i;
+                }
+                pool->slabs++;
+            }
+            while(cache->count < POOL_BATCH && pool->free_list != NULL){
+                object = pool->free_list;
+                pool->free_list = *(void **) object;
+                *(void **) object = cache->free_list;
+                cache->free_list = object;
+                cache->count++;
+            }
+        lock_sem_post(&pool->access, &pool->stats);
+    }
+    object = cache->free_list;
+    cache->free_list = *(void **) object;
+    cache->count--;
+
+    live = __atomic_add_fetch(&pool->live, 1, __ATOMIC_RELAXED);
+    high = __atomic_load_n(&pool->high_water, __ATOMIC_RELAXED);
+    while(live > high && !__atomic_compare_exchange_n(&pool->high_water, &high, live, 0,
+                                                       __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+    return object;
+}
+
+void pool_free(int pool_id, void * object){
+    pool_cache_t *cache = &pool_caches[pool_id];
+
+    if(object == NULL)
+        return;
+    __atomic_sub_fetch(&pools[pool_id].live, 1, __ATOMIC_RELAXED);
+    *(void **) object = cache->free_list;
+    cache->free_list = object;
+    cache->count++;
+    /*a thread that only frees (alarm_thread) hands batches back so the
+    objects can be reused by the threads that allocate*/
+    if(cache->count > 2 * POOL_BATCH){
+        pthread_setspecific(pool_cache_key, pool_caches);
+        pool_return(pool_id, POOL_BATCH);
+    }
+}
+
+void prt_pool_stats(){
+    int i;
+    object_pool_t *pool;
+    long bytes, blocks;
+
+    printf("Pool Statistics:\n");
+    for(i = 0; i < POOL_COUNT; i++){
+        pool = &pools[i];
+        printf("Pool : %s, Size : %d, Live : %d, High Water : %d, Slabs : %d, Capacity : %d\n",
+               pool->name, (int) pool->object_size,
+               __atomic_load_n(&pool->live, __ATOMIC_RELAXED),
+               __atomic_load_n(&pool->high_water, __ATOMIC_RELAXED),
+               pool->slabs, (int) (pool->slabs * (POOL_SLAB_SIZE / pool->object_size)));
+    }
+    lock_sem_wait(&arenaAccess, &arena_stats);
+        bytes = arena_bytes_live;
+        blocks = arena_blocks_live;
+    lock_sem_post(&arenaAccess, &arena_stats);
+    printf("Message Arena : Live Messages : %ld, Live Bytes : %ld, Chunks : %d, Reserved Bytes : %ld\n",
+           blocks, bytes, arena_chunks, (long) arena_chunks * ARENA_CHUNK_SIZE);
+}
+/*<><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><>*/
+/*<><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><>  MESSAGE ARENA FUNCTIONS*/
+/*<><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><>*/
+alarm_payload_t * payload_create(long duration_ms, const char *message){
+    alarm_payload_t *payload;
+    size_t length = strlen(message), size;
+    int size_class;
+
+    /*a block needs room for the header and the '\0', and must be big
+    enough to hold the free list link once it is freed*/
+    if(length > ARENA_MAX_BLOCK - sizeof(alarm_payload_t) - 1)
+        length = ARENA_MAX_BLOCK - sizeof(alarm_payload_t) - 1;
+    size = sizeof(alarm_payload_t) + length + 1;
+    if(size < sizeof(alarm_payload_t) + sizeof(alarm_payload_t *))
+        size = sizeof(alarm_payload_t) + sizeof(alarm_payload_t *);
+    size_class = (size + ARENA_ALIGN - 1) / ARENA_ALIGN;
+
+    lock_sem_wait(&arenaAccess, &arena_stats);
+        payload = arena_free[size_class];
+        if(payload != NULL){
+            arena_free[size_class] = *(alarm_payload_t **) payload->message;
+        } else {
+            if(arena_chunk_used + size_class * ARENA_ALIGN > ARENA_CHUNK_SIZE){
+                /*the tail of the old chunk is too small, it is left unused*/
+                if (posix_memalign((void **) &arena_chunk, ARENA_ALIGN, ARENA_CHUNK_SIZE) != 0)
+                    errno_abort ("Allocate message arena chunk");
+                arena_chunk_used = 0;
+                arena_chunks++;
+            }
+            payload = (alarm_payload_t *) (arena_chunk + arena_chunk_used);
+            arena_chunk_used += size_class * ARENA_ALIGN;
+        }
+        arena_bytes_live += size_class * ARENA_ALIGN;
+        arena_blocks_live++;
+    lock_sem_post(&arenaAccess, &arena_stats);
+
+    payload->size_class = size_class;
+    payload->length = length;
+    payload->seconds = duration_ms / 1000;
+    payload->milliseconds = duration_ms % 1000;
+    memcpy(payload->message, message, length);
+    payload->message[length] = '\0';
+    return payload;
+}
+
+void payload_free(alarm_payload_t *payload){
+    if(payload == NULL)
+        return;
+    lock_sem_wait(&arenaAccess, &arena_stats);
+        *(alarm_payload_t **) payload->message = arena_free[payload->size_class];
+        arena_free[payload->size_class] = payload;
+        arena_bytes_live -= payload->size_class * ARENA_ALIGN;
+        arena_blocks_live--;
+    lock_sem_post(&arenaAccess, &arena_stats);
+}
+/*<><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><>*/
+/*<><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><>  READERS-WRITERS LOCK FUNCTIONS*/
+/*<><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><>*/
+static const char *rw_backend_names[] = {"sem", "pthread", "futex"};
+static const char *rw_policy_names[]  = {"reader", "writer", "fair"};
+
+static long monotonic_ns(){
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000L + now.tv_nsec;
+}
+
+/*sleeps while *word still holds value, a change or a wake ends the sleep*/
+static void futex_wait(unsigned int *word, unsigned int value){
+    syscall(SYS_futex, word, FUTEX_WAIT_PRIVATE, value, NULL, NULL, 0);
+}
+
+static void futex_wake_all(unsigned int *word){
+    syscall(SYS_futex, word, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+}
+
+/*takes one of the protocol's semaphores. the uncontended case is a
+single try, only a wait is timed and added to *waited*/
+static void rw_down(rw_lock_t *lock, int index, long *waited){
+    long start;
+    if(sem_trywait(&lock->sems[index]) == 0)
+        return;
+    start = monotonic_ns();
+    while(sem_wait(&lock->sems[index]) != 0)
+        ;
+    /*+1 so a wait shorter than the clock's resolution still counts as contended*/
+    *waited += monotonic_ns() - start + 1;
+}
+
+static void rw_up(rw_lock_t *lock, int index){
+    sem_post(&lock->sems[index]);
+}
+
+/*the slow path of a futex reader, the fast path saw a writer*/
+static void futex_read_wait(rw_lock_t *lock, unsigned int blocked){
+    unsigned int state, want;
+
+    while(1){
+        state = __atomic_load_n(&lock->state, __ATOMIC_RELAXED);
+        if(!(state & blocked)){
+            if(__atomic_compare_exchange_n(&lock->state, &state, state + RW_READER, 1,
+                                           __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+                return;
+            continue;
+        }
+        want = state | RW_WAITERS;
+        if(want != state && !__atomic_compare_exchange_n(&lock->state, &state, want, 0,
+                                                         __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            continue;
+        futex_wait(&lock->state, want);
+    }
+}
+
+/*the slow path of a futex writer, the lock was not free*/
+static void futex_write_wait(rw_lock_t *lock){
+    unsigned int state, want;
+
+    while(1){
+        state = __atomic_load_n(&lock->state, __ATOMIC_RELAXED);
+        if(!(state & RW_WRITER) && state / RW_READER == 0){
+            /*RW_WAITERS stays, other threads may still sleep*/
+            if(__atomic_compare_exchange_n(&lock->state, &state, RW_WRITER | (state & RW_WAITERS), 1,
+                                           __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+                return;
+            continue;
+        }
+        want = state | RW_WAITERS;
+        if(lock->policy != RW_READER_PREF)
+            want |= RW_WRITER_WAITING;
+        if(want != state && !__atomic_compare_exchange_n(&lock->state, &state, want, 0,
+                                                         __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            continue;
+        futex_wait(&lock->state, want);
+    }
+}
+
+/*wakes every sleeper once state says nobody holds the lock, the ones
+that still cannot enter set RW_WAITERS again and go back to sleep*/
+static void futex_wake(rw_lock_t *lock, unsigned int state){
+    if((state & RW_WAITERS) && !(state & RW_WRITER) && state / RW_READER == 0){
+        __atomic_fetch_and(&lock->state, ~RW_WAITERS, __ATOMIC_RELAXED);
+        futex_wake_all(&lock->state);
+    }
+}
+
+/*adds one acquisition to the statistics, kind is 0 for a reader and 1 for a writer*/
+#ifdef LOCK_PROFILE
+/*the wait of this thread's last acquire, for profile_acquired*/
+__thread long rw_profile_waited;
+
+/*the profiles of the locks this thread holds and since when*/
+__thread struct {
+    lock_profile_t      *profile;
+    long                since;
+} rw_profile_holds[PROFILE_HOLDS];
+__thread int rw_profile_held = 0;
+
+/*returns the histogram bucket of a duration*/
+static int profile_bucket(long ns){
+    int bucket = 0;
+    long us = ns / 1000;
+
+    while(us > 0 && bucket < PROFILE_BUCKETS - 1){
+        us >>= 1;
+        bucket++;
+    }
+    return bucket;
+}
+#endif
+
+/*pthread_key destructor, a finishing thread's counts are reused by the next thread*/
+static void rw_counts_exit(void * arg){
+    __atomic_store_n(&((rw_counts_t *) arg)->in_use, 0, __ATOMIC_RELEASE);
+}
+
+static void rw_counts_key_create(){
+    pthread_key_create(&rw_counts_key, rw_counts_exit);
+}
+
+/*returns the calling thread's counts, claiming a free record or adding a
+new one on its first acquisition*/
+static rw_counts_t * rw_counts(){
+    rw_counts_t *counts;
+    int unused;
+
+    if(rw_counts_self != NULL)
+        return rw_counts_self;
+    pthread_once(&rw_counts_once, rw_counts_key_create);
+    for(counts = __atomic_load_n(&rw_counts_list, __ATOMIC_ACQUIRE); counts != NULL; counts = counts->next){
+        unused = 0;
+        if(__atomic_load_n(&counts->in_use, __ATOMIC_RELAXED) == 0
+           && __atomic_compare_exchange_n(&counts->in_use, &unused, 1, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+            break;
+    }
+    if(counts == NULL){
+        if (posix_memalign((void **) &counts, 64, sizeof(rw_counts_t)) != 0)
+            errno_abort ("Allocate lock counts");
+        memset(counts, 0, sizeof(rw_counts_t));
+        counts->in_use = 1;
+        counts->next = __atomic_load_n(&rw_counts_list, __ATOMIC_RELAXED);
+        while(!__atomic_compare_exchange_n(&rw_counts_list, &counts->next, counts, 0,
+                                           __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+            ;
+    }
+    rw_counts_self = counts;
+    pthread_setspecific(rw_counts_key, counts);
+    return counts;
+}
+
+static void rw_count(rw_lock_t *lock, int kind, long waited){
+    long *count = &rw_counts()->acquisitions[lock->slot - 1][kind];
+
+    /*only this thread writes it, a load and a store are enough*/
+    __atomic_store_n(count, __atomic_load_n(count, __ATOMIC_RELAXED) + 1, __ATOMIC_RELAXED);
+    if(waited > 0){
+        __atomic_add_fetch(&lock->contended[kind], 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&lock->wait_ns[kind], waited, __ATOMIC_RELAXED);
+    }
+#ifdef LOCK_PROFILE
+    __atomic_add_fetch(&lock->profile.wait_hist[kind][profile_bucket(waited)], 1, __ATOMIC_RELAXED);
+    rw_profile_waited = waited;
+#endif
+}
+
+void rw_lock_init(rw_lock_t *lock, const char *name, int backend, int policy){
+    int i, slot = lock->slot;
+    rw_counts_t *counts;
+    pthread_rwlockattr_t attr;
+
+    /*a lock keeps its slot when it is initialized again, its counts restart*/
+    if(slot == 0)
+        slot = __atomic_add_fetch(&rw_lock_slots, 1, __ATOMIC_RELAXED);
+    if(slot > RW_LOCKS_MAX)
+        err_abort (EINVAL, "Too many rw locks");
+    for(counts = __atomic_load_n(&rw_counts_list, __ATOMIC_ACQUIRE); counts != NULL; counts = counts->next)
+        for(i = 0; i < 2; i++)
+            __atomic_store_n(&counts->acquisitions[slot - 1][i], 0, __ATOMIC_RELAXED);
+    memset(lock, 0, sizeof(rw_lock_t));
+    lock->slot = slot;
+    lock->name = name;
+    lock->backend = backend;
+    lock->policy = policy;
+    for(i = 0; i < RW_SEMAPHORES; i++)
+        sem_init(&lock->sems[i],0,1);
+    /*the C library prefers readers unless told otherwise. its writer kind
+    stops new readers while a writer waits, but then a thread must not
+    take the read lock twice, which no caller does*/
+    pthread_rwlockattr_init(&attr);
+    pthread_rwlockattr_setkind_np(&attr, policy == RW_READER_PREF ? PTHREAD_RWLOCK_PREFER_READER_NP
+                                                                  : PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+    pthread_rwlock_init(&lock->rwlock, &attr);
+    pthread_rwlockattr_destroy(&attr);
+}
+
+int rw_lock_configure(rw_lock_t *lock, const char *spec){
+    int backend, policy = lock->policy;
+    const char *colon = strchr(spec, ':');
+    size_t length = colon ? (size_t) (colon - spec) : strlen(spec);
+
+    for(backend = RW_BACKEND_SEM; backend <= RW_BACKEND_FUTEX; backend++)
+        if(strlen(rw_backend_names[backend]) == length
+           && strncmp(spec, rw_backend_names[backend], length) == 0)
+            break;
+    if(backend > RW_BACKEND_FUTEX)
+        return 0;
+    if(colon != NULL){
+        for(policy = RW_READER_PREF; policy <= RW_FAIR; policy++)
+            if(strcmp(colon + 1, rw_policy_names[policy]) == 0)
+                break;
+        if(policy > RW_FAIR)
+            return 0;
+    }
+    rw_lock_init(lock, lock->name, backend, policy);
+    return 1;
+}
+
+void rw_read_lock(rw_lock_t *lock){
+    long waited = 0, start;
+    unsigned int blocked, state;
+
+    if(lock->backend == RW_BACKEND_FUTEX){
+        blocked = lock->policy == RW_READER_PREF ? RW_WRITER : RW_WRITER | RW_WRITER_WAITING;
+        /*the uncontended entry is this one atomic add*/
+        state = __atomic_fetch_add(&lock->state, RW_READER, __ATOMIC_ACQUIRE);
+        if(state & blocked){
+            start = monotonic_ns();
+            /*back out, the last reader to leave may owe a waiting writer a wake*/
+            futex_wake(lock, __atomic_sub_fetch(&lock->state, RW_READER, __ATOMIC_RELEASE));
+            futex_read_wait(lock, blocked);
+            waited = monotonic_ns() - start + 1;
+        }
+    } else if(lock->backend == RW_BACKEND_PTHREAD){
+        if(pthread_rwlock_tryrdlock(&lock->rwlock) != 0){
+            start = monotonic_ns();
+            pthread_rwlock_rdlock(&lock->rwlock);
+            waited = monotonic_ns() - start + 1;
+        }
+    } else {
+        if(lock->policy == RW_WRITER_PREF)
+            rw_down(lock, RW_READ_TRY, &waited);       /*blocked while a writer waits*/
+        else if(lock->policy == RW_FAIR)
+            rw_down(lock, RW_SERVICE_QUEUE, &waited);  /*wait for our turn*/
+        rw_down(lock, RW_COUNT_ACCESS, &waited);
+            lock->readCount++;
+            if(lock->readCount==1) {
+                rw_down(lock, RW_RESOURCE, &waited);
+            }
+        rw_up(lock, RW_COUNT_ACCESS);
+        if(lock->policy == RW_WRITER_PREF)
+            rw_up(lock, RW_READ_TRY);
+        else if(lock->policy == RW_FAIR)
+            rw_up(lock, RW_SERVICE_QUEUE);
+    }
+    rw_count(lock, 0, waited);
+}
+
+void rw_read_unlock(rw_lock_t *lock){
+    long waited = 0;
+
+    if(lock->backend == RW_BACKEND_FUTEX){
+        /*one atomic sub, the futex call only happens when someone sleeps*/
+        futex_wake(lock, __atomic_sub_fetch(&lock->state, RW_READER, __ATOMIC_RELEASE));
+        return;
+    }
+    if(lock->backend == RW_BACKEND_PTHREAD){
+        pthread_rwlock_unlock(&lock->rwlock);
+        return;
+    }
+    rw_down(lock, RW_COUNT_ACCESS, &waited);
+        lock->readCount--;
         /*the last thread releases the database for writting*/
-        if(readCount==0){
-            sem_post(&alarmListAccess);
+        if(lock->readCount==0){
+            rw_up(lock, RW_RESOURCE);
         }
-        
-  sem_post(&readCountAccess);
+    rw_up(lock, RW_COUNT_ACCESS);
+}
+
+void rw_write_lock(rw_lock_t *lock){
+    long waited = 0, start;
+    unsigned int state = 0;
+
+    if(lock->backend == RW_BACKEND_FUTEX){
+        if(!__atomic_compare_exchange_n(&lock->state, &state, RW_WRITER, 0,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)){
+            start = monotonic_ns();
+            futex_write_wait(lock);
+            waited = monotonic_ns() - start + 1;
+        }
+    } else if(lock->backend == RW_BACKEND_PTHREAD){
+        if(pthread_rwlock_trywrlock(&lock->rwlock) != 0){
+            start = monotonic_ns();
+            pthread_rwlock_wrlock(&lock->rwlock);
+            waited = monotonic_ns() - start + 1;
+        }
+    } else if(lock->policy == RW_WRITER_PREF){
+        rw_down(lock, RW_WRITE_COUNT_ACCESS, &waited);
+            lock->writeCount++;
+            /*the first waiting writer closes the door on new readers*/
+            if(lock->writeCount==1) {
+                rw_down(lock, RW_READ_TRY, &waited);
+            }
+        rw_up(lock, RW_WRITE_COUNT_ACCESS);
+        rw_down(lock, RW_RESOURCE, &waited);
+    } else if(lock->policy == RW_FAIR){
+        rw_down(lock, RW_SERVICE_QUEUE, &waited);
+        rw_down(lock, RW_RESOURCE, &waited);
+        rw_up(lock, RW_SERVICE_QUEUE);
+    } else {
+        rw_down(lock, RW_RESOURCE, &waited);
+    }
+    rw_count(lock, 1, waited);
+}
+
+void rw_write_unlock(rw_lock_t *lock){
+    long waited = 0;
+
+    if(lock->backend == RW_BACKEND_FUTEX){
+        futex_wake(lock, __atomic_and_fetch(&lock->state, ~RW_WRITER, __ATOMIC_RELEASE));
+        return;
+    }
+    if(lock->backend == RW_BACKEND_PTHREAD){
+        pthread_rwlock_unlock(&lock->rwlock);
+        return;
+    }
+    rw_up(lock, RW_RESOURCE);
+    if(lock->policy == RW_WRITER_PREF){
+        rw_down(lock, RW_WRITE_COUNT_ACCESS, &waited);
+            lock->writeCount--;
+            /*the last writer lets the readers in again*/
+            if(lock->writeCount==0) {
+                rw_up(lock, RW_READ_TRY);
+            }
+        rw_up(lock, RW_WRITE_COUNT_ACCESS);
+    }
+}
+
+static void lock_count(lock_stats_t *stats, long waited){
+    __atomic_add_fetch(&stats->acquisitions, 1, __ATOMIC_RELAXED);
+    if(waited > 0){
+        __atomic_add_fetch(&stats->contended, 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&stats->wait_ns, waited, __ATOMIC_RELAXED);
+    }
+#ifdef LOCK_PROFILE
+    __atomic_add_fetch(&stats->profile.wait_hist[1][profile_bucket(waited)], 1, __ATOMIC_RELAXED);
+    rw_profile_waited = waited;
+#endif
+}
+
+void lock_sem_wait_at(sem_t *sem, lock_stats_t *stats, const char *function, int line){
+    long start, waited = 0;
+
+    /*like rw_down, only a wait is timed*/
+    if(sem_trywait(sem) != 0){
+        start = monotonic_ns();
+        while(sem_wait(sem) != 0)
+            ;
+        waited = monotonic_ns() - start + 1;
+    }
+    lock_count(stats, waited);
+#ifdef LOCK_PROFILE
+    profile_acquired(&stats->profile, 1, function, line);
+#endif
+}
+
+void lock_sem_post(sem_t *sem, lock_stats_t *stats){
+#ifdef LOCK_PROFILE
+    profile_release(&stats->profile, 1);
+#endif
+    sem_post(sem);
+}
+
+void lock_mutex_lock_at(pthread_mutex_t *mutex, lock_stats_t *stats, const char *function, int line){
+    long start, waited = 0;
+    int status;
+
+    status = pthread_mutex_trylock(mutex);
+    if(status == EBUSY){
+        start = monotonic_ns();
+        status = pthread_mutex_lock(mutex);
+        waited = monotonic_ns() - start + 1;
+    }
+    if (status != 0)
+        err_abort (status, "Lock mutex");
+    lock_count(stats, waited);
+#ifdef LOCK_PROFILE
+    profile_acquired(&stats->profile, 1, function, line);
+#endif
+}
+
+void lock_mutex_unlock(pthread_mutex_t *mutex, lock_stats_t *stats){
+    int status;
+
+#ifdef LOCK_PROFILE
+    profile_release(&stats->profile, 1);
+#endif
+    status = pthread_mutex_unlock(mutex);
+    if (status != 0)
+        err_abort (status, "Unlock mutex");
+}
+
+int lock_cond_wait(pthread_cond_t *cond, pthread_mutex_t *mutex, lock_stats_t *stats,
+                   const struct timespec *abstime){
+    int status;
+
+    /*the wait is not a hold, the hold starts again when it returns*/
+#ifdef LOCK_PROFILE
+    profile_release(&stats->profile, 1);
+#endif
+    if(abstime == NULL)
+        status = pthread_cond_wait(cond, mutex);
+    else
+        status = pthread_cond_timedwait(cond, mutex, abstime);
+#ifdef LOCK_PROFILE
+    profile_hold(&stats->profile);
+#endif
+    return status;
+}
+
+#ifdef LOCK_PROFILE
+void profile_acquired(lock_profile_t *profile, int kind, const char *function, int line){
+    lock_site_t *site;
+    const char *expected;
+    int i, site_line;
+
+    /*a site is found by its function and line, the first acquire from
+    a new site claims a free slot. only the thread whose CAS claimed the
+    slot writes kind and then line, the others wait for line to show*/
+    for(i = 0; i < PROFILE_SITES; i++){
+        site = &profile->sites[i];
+        expected = __atomic_load_n(&site->function, __ATOMIC_ACQUIRE);
+        if(expected == NULL
+           && __atomic_compare_exchange_n(&site->function, &expected, function, 0,
+                                          __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)){
+            site->kind = kind;
+            __atomic_store_n(&site->line, line, __ATOMIC_RELEASE);
+            break;
+        }
+        if(expected != function)
+            continue;
+        while((site_line = __atomic_load_n(&site->line, __ATOMIC_ACQUIRE)) == 0)
+            sched_yield();
+        if(site_line == line && site->kind == kind)
+            break;
+    }
+    if(i < PROFILE_SITES){
+        __atomic_add_fetch(&site->count, 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&site->wait_ns, rw_profile_waited, __ATOMIC_RELAXED);
+    } else {
+        __atomic_add_fetch(&profile->other_sites, 1, __ATOMIC_RELAXED);
+    }
+    profile_hold(profile);
+}
+
+void profile_hold(lock_profile_t *profile){
+    if(rw_profile_held < PROFILE_HOLDS){
+        rw_profile_holds[rw_profile_held].profile = profile;
+        rw_profile_holds[rw_profile_held].since = monotonic_ns();
+    }
+    rw_profile_held++;
+}
+
+void profile_release(lock_profile_t *profile, int kind){
+    int i;
+
+    rw_profile_held--;
+    /*locks are mostly released in reverse order, so the search starts
+    at the newest hold*/
+    for(i = rw_profile_held < PROFILE_HOLDS ? rw_profile_held : PROFILE_HOLDS - 1; i >= 0; i--){
+        if(rw_profile_holds[i].profile == profile){
+            __atomic_add_fetch(&profile->hold_hist[kind][profile_bucket(monotonic_ns() - rw_profile_holds[i].since)],
+                               1, __ATOMIC_RELAXED);
+            for(; i < rw_profile_held && i < PROFILE_HOLDS - 1; i++)
+                rw_profile_holds[i] = rw_profile_holds[i + 1];
+            return;
+        }
+    }
+}
+
+static void prt_profile_hist(const char *title, long *hist){
+    int bucket;
+
+    printf("  %s :", title);
+    for(bucket = 0; bucket < PROFILE_BUCKETS; bucket++){
+        long count = __atomic_load_n(&hist[bucket], __ATOMIC_RELAXED);
+        if(count == 0)
+            continue;
+        if(bucket == 0)
+            printf(" <1us:%ld", count);
+        else
+            printf(" <%ldus:%ld", 1L << bucket, count);
+    }
+    printf("\n");
+}
+
+static int profile_site_compare(const void *a, const void *b){
+    long x = ((const lock_site_t *) a)->wait_ns, y = ((const lock_site_t *) b)->wait_ns;
+    return x > y ? -1 : x < y;
+}
+
+/*exclusive is 1 for a lock_stats_t, it only has the writer side*/
+static void prt_lock_profile(lock_profile_t *profile, int exclusive){
+    lock_site_t sites[PROFILE_SITES];
+    int i, n = 0;
+
+    if(exclusive){
+        prt_profile_hist("Wait", profile->wait_hist[1]);
+        prt_profile_hist("Hold", profile->hold_hist[1]);
+    } else {
+        prt_profile_hist("Read Wait", profile->wait_hist[0]);
+        prt_profile_hist("Read Hold", profile->hold_hist[0]);
+        prt_profile_hist("Write Wait", profile->wait_hist[1]);
+        prt_profile_hist("Write Hold", profile->hold_hist[1]);
+    }
+    for(i = 0; i < PROFILE_SITES; i++){
+        /*a slot whose claimer has not stored the line yet is skipped*/
+        sites[n].line = __atomic_load_n(&profile->sites[i].line, __ATOMIC_ACQUIRE);
+        if(sites[n].line == 0)
+            continue;
+        sites[n].function = profile->sites[i].function;
+        sites[n].kind = profile->sites[i].kind;
+        sites[n].count = __atomic_load_n(&profile->sites[i].count, __ATOMIC_RELAXED);
+        sites[n].wait_ns = __atomic_load_n(&profile->sites[i].wait_ns, __ATOMIC_RELAXED);
+        n++;
+    }
+    /*the sites that waited longest first*/
+    qsort(sites, n, sizeof(lock_site_t), profile_site_compare);
+    for(i = 0; i < n && i < PROFILE_TOP; i++)
+        printf("  Site : %s:%d, Kind : %s, Count : %ld, Wait : %ld us\n",
+               sites[i].function, sites[i].line, exclusive ? "lock" : sites[i].kind ? "write" : "read",
+               sites[i].count, sites[i].wait_ns / 1000);
+    if(profile->other_sites > 0)
+        printf("  Other Sites : %ld\n", profile->other_sites);
+}
+#endif
+
+static void prt_rw_lock(rw_lock_t *lock){
+    long acquisitions[2], contended[2], wait_ns[2];
+    rw_counts_t *counts;
+    int kind;
+
+    for(kind = 0; kind < 2; kind++){
+        acquisitions[kind] = 0;
+        for(counts = __atomic_load_n(&rw_counts_list, __ATOMIC_ACQUIRE); counts != NULL; counts = counts->next)
+            acquisitions[kind] += __atomic_load_n(&counts->acquisitions[lock->slot - 1][kind], __ATOMIC_RELAXED);
+        contended[kind] = __atomic_load_n(&lock->contended[kind], __ATOMIC_RELAXED);
+        wait_ns[kind] = __atomic_load_n(&lock->wait_ns[kind], __ATOMIC_RELAXED);
+    }
+    printf("Lock : %s, Backend : %s, Policy : %s, Reads : %ld, Contended : %ld, Read Wait : %ld us, Writes : %ld, Contended : %ld, Write Wait : %ld us\n",
+           lock->name, rw_backend_names[lock->backend],
+           rw_policy_names[lock->policy],
+           acquisitions[0], contended[0], wait_ns[0] / 1000,
+           acquisitions[1], contended[1], wait_ns[1] / 1000);
+#ifdef LOCK_PROFILE
+    prt_lock_profile(&lock->profile, 0);
+#endif
+}
+
+static void prt_lock_stats_of(lock_stats_t *stats, const char *backend){
+    printf("Lock : %s, Backend : %s, Acquisitions : %ld, Contended : %ld, Wait : %ld us\n",
+           stats->name, backend,
+           __atomic_load_n(&stats->acquisitions, __ATOMIC_RELAXED),
+           __atomic_load_n(&stats->contended, __ATOMIC_RELAXED),
+           __atomic_load_n(&stats->wait_ns, __ATOMIC_RELAXED) / 1000);
+#ifdef LOCK_PROFILE
+    prt_lock_profile(&stats->profile, 1);
+#endif
+}
+
+void prt_lock_stats(){
+    int i;
+
+    printf("Lock Statistics:\n");
+    for(i = 0; i < alarm_shard_count; i++)
+        prt_rw_lock(&alarm_shards[i].lock);
+    prt_rw_lock(&thread_list_lock);
+    prt_lock_stats_of(&alarm_mutex_stats, "mutex");
+    prt_lock_stats_of(&display_mutex_stats, "mutex");
+    prt_lock_stats_of(&arena_stats, "sem");
+    for(i = 0; i < POOL_COUNT; i++)
+        prt_lock_stats_of(&pools[i].stats, "sem");
+    printf("Epoch : %lu, Retired : %ld, Reclaimed : %ld\n",
+           __atomic_load_n(&rcu_epoch, __ATOMIC_RELAXED),
+           __atomic_load_n(&rcu_retired_count, __ATOMIC_RELAXED),
+           __atomic_load_n(&rcu_reclaimed_count, __ATOMIC_RELAXED));
+}
+
+#ifdef LOCK_PROFILE
+/*from here on every lock call records its call site and hold time. the
+functions above are not wrapped, the macros do not expand themselves*/
+#define rw_read_lock(lock)    (rw_read_lock(lock), profile_acquired(&(lock)->profile, 0, __func__, __LINE__))
+#define rw_write_lock(lock)   (rw_write_lock(lock), profile_acquired(&(lock)->profile, 1, __func__, __LINE__))
+#define rw_read_unlock(lock)  (profile_release(&(lock)->profile, 0), rw_read_unlock(lock))
+#define rw_write_unlock(lock) (profile_release(&(lock)->profile, 1), rw_write_unlock(lock))
+#endif
+/*<><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><>*/
+/*<><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><>  EPOCH RECLAMATION FUNCTIONS*/
+/*<><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><>*/
+/*pthread_key destructor, a finishing thread's record is reused by the next reader*/
+static void rcu_reader_exit(void * arg){
+    rcu_reader_t *reader = (rcu_reader_t *) arg;
+    __atomic_store_n(&reader->state, 0, __ATOMIC_RELEASE);
+    __atomic_store_n(&reader->in_use, 0, __ATOMIC_RELEASE);
+}
+
+/*returns the calling thread's record, claiming a free one or adding a
+new one on its first read section*/
+static rcu_reader_t * rcu_reader(){
+    rcu_reader_t *reader;
+    int unused;
+
+    if(rcu_self != NULL)
+        return rcu_self;
+    for(reader = __atomic_load_n(&rcu_readers, __ATOMIC_ACQUIRE); reader != NULL; reader = reader->next){
+        unused = 0;
+        if(__atomic_load_n(&reader->in_use, __ATOMIC_RELAXED) == 0
+           && __atomic_compare_exchange_n(&reader->in_use, &unused, 1, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+            break;
+    }
+    if(reader == NULL){
+        if (posix_memalign((void **) &reader, 64, sizeof(rcu_reader_t)) != 0)
+            errno_abort ("Allocate reader record");
+        reader->state = 0;
+        reader->in_use = 1;
+        reader->next = __atomic_load_n(&rcu_readers, __ATOMIC_RELAXED);
+        while(!__atomic_compare_exchange_n(&rcu_readers, &reader->next, reader, 0,
+                                           __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+            ;
+    }
+    reader->depth = 0;
+    rcu_self = reader;
+    pthread_setspecific(rcu_reader_key, reader);
+    return reader;
+}
+
+void rcu_init(){
+    pthread_key_create(&rcu_reader_key, rcu_reader_exit);
+}
+
+void rcu_read_lock(){
+    rcu_reader_t *reader = rcu_reader();
+
+    if(reader->depth++ > 0)
+        return;
+    /*the announcement must be visible to the reclaimer before any
+    pointer of the list is loaded*/
+    __atomic_store_n(&reader->state, (__atomic_load_n(&rcu_epoch, __ATOMIC_ACQUIRE) << 1) | 1, __ATOMIC_SEQ_CST);
+}
+
+void rcu_read_unlock(){
+    rcu_reader_t *reader = rcu_self;
+
+    if(--reader->depth > 0)
+        return;
+    __atomic_store_n(&reader->state, 0, __ATOMIC_RELEASE);
+}
+
+void rcu_retire(rcu_head_t *head, void (*reclaim)(rcu_head_t *head)){
+    head->reclaim = reclaim;
+    head->epoch = __atomic_load_n(&rcu_epoch, __ATOMIC_SEQ_CST);
+    head->next = __atomic_load_n(&rcu_retired, __ATOMIC_RELAXED);
+    while(!__atomic_compare_exchange_n(&rcu_retired, &head->next, head, 0,
+                                       __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+        ;
+    __atomic_add_fetch(&rcu_retired_count, 1, __ATOMIC_RELAXED);
+}
+
+/*a malloc'd block waiting for its grace period*/
+typedef struct rcu_block_tag {
+    rcu_head_t          rcu;
+    void                *block;
+} rcu_block_t;
+
+static void rcu_reclaim_block(rcu_head_t *head){
+    rcu_block_t *retired = (rcu_block_t *) head;
+    free(retired->block);
+    free(retired);
+}
+
+void rcu_retire_memory(void *block){
+    rcu_block_t *retired;
+
+    if(block == NULL)
+        return;
+    retired = (rcu_block_t *) malloc(sizeof(rcu_block_t));
+    if (retired == NULL)
+        errno_abort ("Allocate retired block");
+    retired->block = block;
+    rcu_retire(&retired->rcu, rcu_reclaim_block);
+}
+
+void rcu_reclaim(){
+    rcu_reader_t *reader;
+    rcu_head_t *head, *next, *keep = NULL, **keep_tail = &keep;
+    unsigned long epoch = __atomic_load_n(&rcu_epoch, __ATOMIC_SEQ_CST), state;
+
+    /*the epoch moves on only once every thread inside a read section has
+    announced the current one, so an object retired in epoch e can only
+    be seen by readers that leave before epoch e + 2*/
+    for(reader = __atomic_load_n(&rcu_readers, __ATOMIC_ACQUIRE); reader != NULL; reader = reader->next){
+        state = __atomic_load_n(&reader->state, __ATOMIC_SEQ_CST);
+        if((state & 1) && (state >> 1) != epoch)
+            break;
+    }
+    if(reader == NULL)
+        __atomic_store_n(&rcu_epoch, ++epoch, __ATOMIC_SEQ_CST);
+
+    head = __atomic_exchange_n(&rcu_retired, NULL, __ATOMIC_ACQUIRE);
+    for(; head != NULL; head = next){
+        next = head->next;
+        if(head->epoch + 2 <= epoch){
+            head->reclaim(head);
+            __atomic_add_fetch(&rcu_reclaimed_count, 1, __ATOMIC_RELAXED);
+        } else {
+            *keep_tail = head;
+            keep_tail = &head->next;
+        }
+    }
+    /*the ones that still wait go back in front of whatever was retired meanwhile*/
+    if(keep != NULL){
+        *keep_tail = __atomic_load_n(&rcu_retired, __ATOMIC_RELAXED);
+        while(!__atomic_compare_exchange_n(&rcu_retired, keep_tail, keep, 0,
+                                           __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+            ;
+    }
+}
+/*<><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><>*/
+/*<><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><>  LOCK-FREE ALARM LIST FUNCTIONS*/
+/*<><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><>*/
+/*marks an alarm as deleted, returns 0 if another thread marked it first*/
+static int lf_mark(alarm_t *alarm){
+    alarm_t *link = __atomic_load_n(&alarm->link, __ATOMIC_RELAXED);
+
+    while(!LINK_MARKED(link)){
+        if(__atomic_compare_exchange_n(&alarm->link, &link, (alarm_t *) ((unsigned long) link | LINK_MARK), 1,
+                                       __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+            return 1;
+    }
+    return 0;
+}
+
+alarm_t * lf_search(alarm_shard_t *shard, long key, alarm_t ***prev){
+    alarm_t **last, *curr, *link, *expected;
+
+retry:
+    last = &shard->list;
+    curr = __atomic_load_n(last, __ATOMIC_ACQUIRE);
+    while(curr != NULL){
+        link = __atomic_load_n(&curr->link, __ATOMIC_ACQUIRE);
+        if(LINK_MARKED(link)){
+            /*curr is deleted, help unlink it. a failed CAS means the link
+            in front of it changed or was marked itself, start over*/
+            expected = curr;
+            if(!__atomic_compare_exchange_n(last, &expected, LINK_PTR(link), 0,
+                                            __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+                goto retry;
+            /*only the thread whose CAS unlinked the alarm retires it*/
+            alarm_retire(curr);
+            curr = LINK_PTR(link);
+            continue;
+        }
+        if(curr->number >= key)
+            break;
+        last = &curr->link;
+        curr = link;
+    }
+    *prev = last;
+    return curr;
+}
+
+alarm_t * lf_find(alarm_shard_t *shard, int msg_number){
+    alarm_t *curr, *link;
+
+    for(curr = __atomic_load_n(&shard->list, __ATOMIC_ACQUIRE); curr != NULL; curr = LINK_PTR(link)){
+        link = __atomic_load_n(&curr->link, __ATOMIC_ACQUIRE);
+        if(curr->number > msg_number)
+            break;
+        if(curr->number == msg_number && !LINK_MARKED(link))
+            return curr;
+    }
+    return NULL;
+}
+
+/*skips the deleted alarms from alarm on*/
+static alarm_t * lf_live(alarm_t *alarm){
+    alarm_t *link;
+
+    for(; alarm != NULL; alarm = LINK_PTR(link)){
+        link = __atomic_load_n(&alarm->link, __ATOMIC_ACQUIRE);
+        if(!LINK_MARKED(link))
+            break;
+    }
+    return alarm;
 }
 
+alarm_t * lf_first(alarm_shard_t *shard){
+    return lf_live(__atomic_load_n(&shard->list, __ATOMIC_ACQUIRE));
+}
+
+alarm_t * lf_next(alarm_t *alarm){
+    return lf_live(LINK_PTR(__atomic_load_n(&alarm->link, __ATOMIC_ACQUIRE)));
+}
+
+int lf_insert(alarm_shard_t *shard, alarm_t *alarm, int *replaced_type){
+    alarm_t **prev, *curr, **unused;
+
+    while(1){
+        curr = lf_search(shard, alarm->number, &prev);
+        /*a replacement is linked in front of the alarm it replaces, so
+        the message number never is missing from the list, and a search
+        finds the newer alarm first*/
+        alarm->state = curr != NULL && curr->number == alarm->number
+                       && ALARM_STATE(curr) == ALARM_CANCELLED ? ALARM_CANCELLED : ALARM_PENDING;
+        alarm->link = curr;
+        if(__atomic_compare_exchange_n(prev, &curr, alarm, 0, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+            break;
+    }
+    if(curr == NULL || curr->number != alarm->number)
+        return 0;
+    *replaced_type = curr->type;
+    /*a cancel that got to curr after the check above carries over too*/
+    if(!alarm_settle(curr, ALARM_REPLACED) && ALARM_STATE(curr) == ALARM_CANCELLED)
+        alarm_settle(alarm, ALARM_CANCELLED);
+    if(!lf_mark(curr))
+        return 0;       /*a Type C request took it out first*/
+    /*the replaced alarm sits behind the new one, the search has to go
+    past the number to unlink it*/
+    lf_search(shard, (long) alarm->number + 1, &unused);
+    return 1;
+}
+
+int lf_remove(alarm_shard_t *shard, int msg_number){
+    alarm_t **prev, *curr;
+
+    while(1){
+        curr = lf_search(shard, msg_number, &prev);
+        if(curr == NULL || curr->number != msg_number)
+            return 0;
+        if(lf_mark(curr)){
+            alarm_settle(curr, ALARM_CANCELLED);
+            /*the search unlinks it, or leaves it to the thread in its way*/
+            lf_search(shard, (long) msg_number + 1, &prev);
+            return 1;
+        }
+        /*another thread deleted it first, a replacement may be next in line*/
+    }
+}
+/*<><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><>*/
+/*<><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><>  TYPE A ALARM_LIST FUNCTIONS*/
+/*<><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><>*/
 void prt_alarm_list(){
-  /*assumes alarm list has been locked before call*/
+  /*the shards are merged by message number. it runs in a read section,
+  so the caller needs no lock of the other shards*/
   #ifdef DEBUG    
+        alarm_t *heads[ALARM_SHARDS_MAX], *next;
+        int i, lowest;
+
+        rcu_read_lock();
+        for(i = 0; i < alarm_shard_count; i++)
+            heads[i] = lf_first(&alarm_shards[i]);
         printf ("[list: \n");
-        alarm_t *next;
-        for (next = alarm_list; next != NULL; next = next->link)
-            printf ("N : %d, S : %d, Ty : %d, Ti : %ld, Msg : %s \n",
-            next->number, next->seconds, next->type, next->time, next->message);
+        while(1){
+            lowest = -1;
+            for(i = 0; i < alarm_shard_count; i++)
+                if(heads[i] != NULL && (lowest < 0 || heads[i]->number < heads[lowest]->number))
+                    lowest = i;
+            if(lowest < 0)
+                break;
+            next = heads[lowest];
+            printf ("N : %d, S : %d.%03d, Ty : %d, Ti : %ld, Msg : %s \n",
+            next->number, next->payload->seconds, next->payload->milliseconds, next->type,
+            next->deadline / 1000000, next->payload->message);
+            heads[lowest] = lf_next(next);
+        }
         printf ("]\n");    
+        rcu_read_unlock();
   #endif
 }
 
-void * add_to_alarm_list (void * arg){
-    int status;
-    alarm_t **last, *next, *alarm = (alarm_t *) arg;
-    int is_replaced = 0;    
-    int replaced_type;
+void alarm_free(alarm_t *alarm){
+    payload_free(alarm->payload);
+    pool_free(POOL_ALARM, alarm);
+}
 
-    sem_wait(&alarmListAccess); /*lock*/    
-        last = &alarm_list;
-        next = *last;
+static void alarm_reclaim(rcu_head_t *head){
+    alarm_free((alarm_t *) ((char *) head - offsetof(alarm_t, rcu)));
+}
 
-        while (next != NULL) {
-            if (next->number > alarm->number) {
-                alarm->link = next;
-                *last = alarm;
-                break;
-            } else if (next->number == alarm->number){
-                /*if on insertion, the currently pointed alarm has same message_number
-                as the new, replace the current by the new*/           
-                is_replaced = 1;
-                replaced_type = next->type;
-                alarm->link = next->link;
-                *last = alarm;
-                free(next);
-                printf("Type A Replacement Alarm Request With Message Number (%d) Inserted Into Alarm List at <%ld>: <Type A>\n",
-                        alarm->number,time(NULL));
-                break;
-            }
-            last = &next->link;
-            next = next->link;
-        }
-        /*
-        * If we reached the end of the list, insert the new alarm
-        * there.  ("next" is NULL, and "last" points to the link
-        * field of the last item, or to the list header.)
-        */
-        if (next == NULL) {
-            *last = alarm;
-            alarm->link = NULL;
-        }   
-        if(!is_replaced){
-            printf("Type A Alarm Request With Message Number (%d) Inserted Into Alarm List at <%ld>: <Type A>\n",
-            alarm->number,time(NULL));
+void alarm_retire(alarm_t *alarm){
+    rcu_retire(&alarm->rcu, alarm_reclaim);
+}
+
+alarm_shard_t * alarm_shard(int msg_number){
+    /*the top bits of the fibonacci hash pick the shard, the key tables
+    use the bottom bits, so the keys of one shard still spread over its table*/
+    unsigned int hash = (unsigned int) msg_number * 2654435769u;
+    return &alarm_shards[((unsigned long long) hash * alarm_shard_count) >> 32];
+}
+
+alarm_t * alarm_create(long duration_ms, int msg_type, int msg_number, const char *message){
+    alarm_t *alarm = (alarm_t*) pool_alloc(POOL_ALARM);
+
+    /*the message is copied whole into the arena, it is no longer
+    truncated to a fixed size*/
+    alarm->payload = payload_create(duration_ms, message);
+    alarm->type = msg_type;
+    alarm->number = msg_number;
+    /*a monotonic deadline is not moved by changes to the wall clock*/
+    alarm->deadline = monotonic_ns() + duration_ms * 1000000L;
+    alarm->state = ALARM_PENDING;
+    alarm->link = NULL;
+    alarm->pprev = NULL;
+    alarm->heap_index = -1;
+    alarm->wheel_next = NULL;
+    alarm->wheel_pprev = NULL;
+    alarm->bucket = NULL;
+    return alarm;
+}
+
+long parse_duration_ms(const char *text){
+    long seconds = 0, milliseconds = 0;
+    int digits = 0, scale = 100;
+
+    for(; *text >= '0' && *text <= '9'; text++){
+        /*more than INT_MAX seconds does not fit alarm_payload_t*/
+        if(++digits > 9)
+            return -1;
+        seconds = seconds * 10 + (*text - '0');
+    }
+    if(digits == 0)
+        return -1;
+    if(*text == '.'){
+        for(text++, digits = 0; *text >= '0' && *text <= '9'; text++, scale /= 10){
+            if(++digits > 3)
+                return -1;
+            milliseconds += (*text - '0') * scale;
+        }
+        if(digits == 0)
+            return -1;
+    }
+    return *text == '\0' ? seconds * 1000 + milliseconds : -1;
+}
+
+void alarm_shards_init(){
+    static char names[ALARM_SHARDS_MAX][24];
+    int i;
+    for(i = 0; i < ALARM_SHARDS_MAX; i++){
+        snprintf(names[i], sizeof(names[i]), "alarm_list[%d]", i);
+        rw_lock_init(&alarm_shards[i].lock, names[i], ALARM_LOCK_BACKEND, ALARM_LOCK_POLICY);
+        alarm_shards[i].table.key_offset = offsetof(alarm_t, number);
+    }
+}
+
+/*links an alarm into alarm_list at the link field last*/
+static void list_link(alarm_t **last, alarm_t *alarm){
+    alarm->link = *last;
+    if(alarm->link != NULL)
+        alarm->link->pprev = &alarm->link;
+    /*the alarm is complete before a reader can reach it*/
+    __atomic_store_n(last, alarm, __ATOMIC_RELEASE);
+    alarm->pprev = last;
+}
+
+/*unlinks an alarm from alarm_list in O(1)*/
+static void list_unlink(alarm_t *alarm){
+    /*alarm->link is left alone, a reader standing on the alarm still
+    finds the rest of the list*/
+    __atomic_store_n(alarm->pprev, alarm->link, __ATOMIC_RELEASE);
+    if(alarm->link != NULL)
+        alarm->link->pprev = alarm->pprev;
+}
+
+int store_insert(alarm_t *alarm, int *replaced_type){
+    alarm_t **last, *next;
+    alarm_shard_t *shard = alarm_shard(alarm->number);
+    int is_replaced = 0;
+
+    if(alarm_store == STORE_LOCKFREE){
+        rcu_read_lock();
+            is_replaced = lf_insert(shard, alarm, replaced_type);
+        rcu_read_unlock();
+        return is_replaced;
+    }
+    /*only the shard of the message number is locked, inserts of other
+    shards go ahead at the same time*/
+    rw_write_lock(&shard->lock); /*lock*/    
+        next = (alarm_t *) key_table_find(&shard->table, alarm->number);
+        if (next != NULL){
+            /*an alarm with the same message_number exists, the new alarm
+            takes its place in the list without walking it*/
+            is_replaced = 1;
+            *replaced_type = next->type;
+            /*a queued Type C request applies to the message number, so it
+            carries over to the replacement. add_to_removal_list cancels
+            without the shard lock, the settle tells which came first*/
+            if(!alarm_settle(next, ALARM_REPLACED) && ALARM_STATE(next) == ALARM_CANCELLED)
+                alarm->state = ALARM_CANCELLED;
+            list_link(next->pprev, alarm);
+            alarm_detach(shard, next);
+            alarm_retire(next);
         } else {
-            printf("Stopped Displaying Replaced Alarm With Message Type (%d) at <%ld>: <Type A>\n",
-            replaced_type,time(NULL));
+            last = &shard->list;
+            next = *last;
+            /*
+            * Find the first alarm with a bigger message_number, or the
+            * end of the list, and insert the new alarm in front of it.
+            */
+            while (next != NULL && next->number < alarm->number) {
+                last = &next->link;
+                next = next->link;
+            }
+            list_link(last, alarm);
         }
-        prt_alarm_list();
-    
-    sem_post(&alarmListAccess); /*unlock*/
+        /*the table is what store_find looks in, the alarm goes in it
+        last so a lock-free cancel never finds it outside its bucket*/
+        bucket_add(shard, alarm);
+        key_table_insert(&shard->table, alarm);
+        expiry_schedule(shard, alarm);
+    rw_write_unlock(&shard->lock); /*unlock*/
+    return is_replaced;
+}
+
+int store_remove(int msg_number){
+    alarm_t *temp;
+    alarm_shard_t *shard = alarm_shard(msg_number);
+
+    int removed;
+
+    if(alarm_store == STORE_LOCKFREE){
+        rcu_read_lock();
+            removed = lf_remove(shard, msg_number);
+        rcu_read_unlock();
+        return removed;
+    }
+    rw_write_lock(&shard->lock); /*lock*/
+        /*message numbers are unique in alarm_list, so there is at most
+        one alarm to remove and the shard's table finds it directly*/
+        temp = (alarm_t *) key_table_find(&shard->table, msg_number);
+        if (temp != NULL){
+            alarm_detach(shard, temp);
+            alarm_retire(temp);
+        }
+    rw_write_unlock(&shard->lock); /*unlock*/
+    return temp != NULL;
+}
+
+alarm_t * store_find(int msg_number){
+    alarm_shard_t *shard = alarm_shard(msg_number);
+
+    if(alarm_store == STORE_LOCKFREE)
+        return lf_find(shard, msg_number);
+    return (alarm_t *) key_table_find(&shard->table, msg_number);
+}
+
+alarm_t * scan_type_first(alarm_shard_t *shard, int msg_type){
+    type_bucket_t *bucket;
+    alarm_t *alarm;
+
+    if(alarm_store == STORE_LOCKFREE){
+        /*there are no buckets, the whole shard is walked*/
+        for(alarm = lf_first(shard); alarm != NULL && alarm->type != msg_type; alarm = lf_next(alarm))
+            ;
+        return alarm;
+    }
+    bucket = bucket_find(shard, msg_type);
+    return bucket ? __atomic_load_n(&bucket->alarms, __ATOMIC_ACQUIRE) : NULL;
+}
+
+alarm_t * scan_type_next(alarm_t *alarm){
+    int msg_type = alarm->type;
+
+    if(alarm_store == STORE_LOCKFREE){
+        do
+            alarm = lf_next(alarm);
+        while(alarm != NULL && alarm->type != msg_type);
+        return alarm;
+    }
+    return __atomic_load_n(&alarm->type_next, __ATOMIC_ACQUIRE);
+}
+
+void * add_to_alarm_list (void * arg){
+    alarm_t *alarm = (alarm_t *) arg;
+    int replaced_type;
+
+    if(store_insert(alarm, &replaced_type)){
+        printf("Type A Replacement Alarm Request With Message Number (%d) Inserted Into Alarm List at <%ld>: <Type A>\n",
+                alarm->number,time(NULL));
+        printf("Stopped Displaying Replaced Alarm With Message Type (%d) at <%ld>: <Type A>\n",
+        replaced_type,time(NULL));
+    } else {
+        printf("Type A Alarm Request With Message Number (%d) Inserted Into Alarm List at <%ld>: <Type A>\n",
+        alarm->number,time(NULL));
+    }
+    prt_alarm_list();
+    /*the new alarm may be due before the deadline alarm_thread waits for*/
+    alarm_thread_wake();
 }
 
 /*WRITER FUNCTION*/
 void remove_from_alarm_list(int msg_number, int print_msg){
-  sem_wait(&alarmListAccess); /*lock*/
-
-  /*Remove all alarms with the specified type*/
-  /* loop until all type=x alarm requests are removed*/
-  while(1){
-      alarm_t *temp = alarm_list, *prev;
-      /*If found at first remove it there*/
-      if (temp != NULL && temp->number == msg_number){
-          alarm_list = temp->link;
-          free(temp);
+  store_remove(msg_number);
+  prt_alarm_list();
+  if(print_msg)
+    printf("Type C Alarm Request Processed at <%ld>: Alarm Request With Message Number (%d) Removed\n",time(NULL),msg_number);
+}
+
+void remove_batch_from_alarm_list(removal_ds *batch){
+  alarm_t *temp;
+  alarm_shard_t *shard;
+  removal_ds *next;
+  int i, locked;
+
+  /*every number is found through its shard's table and unlinked in O(1).
+  each shard that has numbers in the batch is locked once, the others
+  are not locked at all*/
+  for(i = 0; i < alarm_shard_count; i++){
+      shard = &alarm_shards[i];
+      locked = 0;
+      if(alarm_store == STORE_LOCKFREE){
+          /*no locks, each number is deleted on its own*/
+          for(next = batch; next != NULL; next = next->link)
+              if(alarm_shard(next->number) == shard)
+                  store_remove(next->number);
           continue;
-      } else {
-          /*If alarm is not at first, then iterate through and find it*/
-          while(temp != NULL && temp->number != msg_number){
-              prev = temp;
-              temp = temp->link;
+      }
+      for(next = batch; next != NULL; next = next->link){
+          if(alarm_shard(next->number) != shard)
+              continue;
+          if(!locked){
+              rw_write_lock(&shard->lock); /*lock*/
+              locked = 1;
           }
-
-          /*if all the specified alarms are removed exit the infinite loop*/
-          if(temp == NULL){
-              sem_post(&alarmListAccess); /*unlock*/
-              break;
+          temp = (alarm_t *) key_table_find(&shard->table, next->number);
+          if (temp != NULL){
+              alarm_detach(shard, temp);
+              alarm_retire(temp);
           }
-          prev->link = temp->link;
-          free(temp);
       }
+      if(locked)
+          rw_write_unlock(&shard->lock); /*unlock*/
   }
   prt_alarm_list();
-  if(print_msg)
-    printf("Type C Alarm Request Processed at <%ld>: Alarm Request With Message Number (%d) Removed\n",time(NULL),msg_number);
+
+  for(next = batch; next != NULL; next = next->link)
+      printf("Type C Alarm Request Processed at <%ld>: Alarm Request With Message Number (%d) Removed\n",time(NULL),next->number);
+}
+
+void alarm_detach(alarm_shard_t *shard, alarm_t *alarm){
+    alarm_settle(alarm, ALARM_CANCELLED);
+    if(ALARM_STATE(alarm) == ALARM_EXPIRED)
+        __atomic_sub_fetch(&shard->done_count, 1, __ATOMIC_RELAXED);
+    list_unlink(alarm);
+    key_table_remove(&shard->table, alarm->number);
+    bucket_remove(shard, alarm);
+    expiry_cancel(shard, alarm);
 }
 
 
@@ -309,23 +2250,34 @@ int alarm_exists(int msg_id, int type){
     message_type(0) or message_number(1)*/
 
     alarm_t *next;
-    int alr_exists = 0;
-    alarm_reader_semaphore_lock();  
+    type_bucket_t *bucket;
+    int alr_exists = 0, i;
+    /*a read section never waits for the writers, nor they for it*/
+    rcu_read_lock();
         switch(type)
         {
             case 0: /*message_type search*/
-                for (next = alarm_list; next != NULL; next = next->link){
-                    if(next->type == msg_id && !next->is_done){
-                        alr_exists++;
+                for(i = 0; i < alarm_shard_count; i++){
+                    if(alarm_store == STORE_LOCKFREE){
+                        for(next = scan_type_first(&alarm_shards[i], msg_id); next != NULL; next = scan_type_next(next))
+                            if(ALARM_LIVE(ALARM_STATE(next)))
+                                alr_exists++;
+                        continue;
+                    }
+                    /*every shard's bucket keeps a live count, so nothing is walked*/
+                    bucket = bucket_find(&alarm_shards[i], msg_id);
+                    if(bucket != NULL){
+                        alr_exists += __atomic_load_n(&bucket->active, __ATOMIC_ACQUIRE);
                     }
                 }
                 break;
                                 
             case 1: /*message_number search*/
-                for (next = alarm_list; next != NULL; next = next->link){
-                    if(next->number == msg_id && !next->is_done){
-                        alr_exists++;
-                    }
+                /*a cancelled alarm still exists until the removal queue
+                takes it out, a second Type C for it is reported as such*/
+                next = store_find(msg_id);
+                if(next != NULL && ALARM_STATE(next) != ALARM_EXPIRED){
+                    alr_exists++;
                 }
                 break;
                 
@@ -334,100 +2286,636 @@ int alarm_exists(int msg_id, int type){
                 break;
         }      
         
-    alarm_reader_semaphore_release();
+    rcu_read_unlock();
     return alr_exists;
 }
 
 
-void remove_alarms_that_are_done(){ /*reads alarm_list*/
-    alarm_t * next;
-    int msg_number;
+void remove_alarms_that_are_done(){ /*writes alarm_list*/
+    alarm_t *next, *link, **prev;
+    alarm_shard_t *shard;
+    int removed = 0, i;
+
+    for(i = 0; i < alarm_shard_count; i++){
+        shard = &alarm_shards[i];
+        /*nothing in this shard has expired since the last sweep, skip the lock*/
+        if(__atomic_load_n(&shard->done_count, __ATOMIC_RELAXED) == 0)
+            continue;
+
+        if(alarm_store == STORE_LOCKFREE){
+            __atomic_store_n(&shard->done_count, 0, __ATOMIC_RELAXED);
+            rcu_read_lock();
+                for(next = lf_first(shard); next != NULL; next = lf_next(next))
+                    if(ALARM_STATE(next) == ALARM_EXPIRED && lf_mark(next))
+                        removed++;
+                /*one search past the last number unlinks every marked alarm*/
+                lf_search(shard, (long) INT_MAX + 1, &prev);
+            rcu_read_unlock();
+            continue;
+        }
+
+        rw_write_lock(&shard->lock); /*lock*/
+            /*one traversal unlinks every done alarm and retires it*/
+            for(next = shard->list; next != NULL; next = link){ 
+                link = next->link;
+                if(ALARM_STATE(next) == ALARM_EXPIRED){
+                    alarm_detach(shard, next);
+                    alarm_retire(next);
+                    removed++;
+                }
+            }
+        rw_write_unlock(&shard->lock); /*unlock*/
+    }
+    if(removed)
+        prt_alarm_list();
+}
+
+void expire_alarms_that_are_due(){ /*writes alarm_list*/
+    alarm_t *alarm;
+    alarm_shard_t *shard;
+    long now = monotonic_ns();
+    int i;
+
+    for(i = 0; i < alarm_shard_count; i++){
+        shard = &alarm_shards[i];
+        if(alarm_store == STORE_LOCKFREE){
+            /*there is no expiry engine, the shard is walked*/
+            rcu_read_lock();
+                for(alarm = lf_first(shard); alarm != NULL; alarm = lf_next(alarm)){
+                    if(alarm->deadline <= now && alarm_settle(alarm, ALARM_EXPIRED)){
+                        __atomic_add_fetch(&shard->done_count, 1, __ATOMIC_RELAXED);
+                        printf("ALARM IS NOW DONE\n");
+                    }
+                }
+            rcu_read_unlock();
+            continue;
+        }
+        rw_write_lock(&shard->lock); /*lock*/
+            /*the expiry engine only hands out the alarms that are due, so this
+            never walks the shard's list*/
+            while((alarm = expiry_next_due(shard, now)) != NULL){
+                /*a cancelled alarm leaves the engine here without expiring*/
+                if(alarm_mark_done(shard, alarm))
+                    printf("ALARM IS NOW DONE\n");
+            }
+        rw_write_unlock(&shard->lock); /*unlock*/
+    }
+}
+/*<><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><>*/
+/*<><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><>  KEY TABLE FUNCTIONS*/
+/*<><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><>*/
+#define KEY_OF(table, node) (*(int *) ((char *) (node) + (table)->key_offset))
+
+/*marks a deleted slot, a probe goes on past it*/
+static char key_tombstone;
+#define KEY_TOMBSTONE ((void *) &key_tombstone)
+
+static unsigned int key_table_hash(int key, int capacity){
+    /*fibonacci hashing spreads consecutive keys apart*/
+    return ((unsigned int) key * 2654435769u) & (capacity - 1);
+}
+
+void * key_table_find(key_table_t *table, int key){
+    key_slots_t *array = __atomic_load_n(&table->array, __ATOMIC_ACQUIRE);
+    void *node;
+    unsigned int i, mask;
+
+    if(array == NULL)
+        return NULL;
+    /*a writer only ever stores into a slot, so whatever this probe sees is
+    an entry of this array. a rebuilt array is a new one, the old one is
+    kept until the read section ends*/
+    mask = array->capacity - 1;
+    for(i = key_table_hash(key, array->capacity);
+        (node = __atomic_load_n(&array->slots[i], __ATOMIC_ACQUIRE)) != NULL; i = (i + 1) & mask){
+        if(node != KEY_TOMBSTONE && KEY_OF(table, node) == key)
+            return node;
+    }
+    return NULL;
+}
+
+/*copies the live entries into a new array, dropping the tombstones. it
+grows the table only when the live entries need it*/
+static void key_table_rebuild(key_table_t *table){
+    key_slots_t *old = table->array, *array;
+    int capacity = old ? old->capacity : 64, j;
+    unsigned int i;
+
+    while(4 * (table->count + 1) > capacity)
+        capacity *= 2;
+    array = (key_slots_t *) calloc(1, sizeof(key_slots_t) + capacity * sizeof(void *));
+    if (array == NULL)
+        errno_abort ("Allocate key table");
+    array->capacity = capacity;
+    for(j = 0; old != NULL && j < old->capacity; j++){
+        if(old->slots[j] == NULL || old->slots[j] == KEY_TOMBSTONE)
+            continue;
+        for(i = key_table_hash(KEY_OF(table, old->slots[j]), capacity); array->slots[i] != NULL; i = (i + 1) & (capacity - 1))
+            ;
+        array->slots[i] = old->slots[j];
+    }
+    table->used = table->count;
+    __atomic_store_n(&table->array, array, __ATOMIC_RELEASE);
+    if(old != NULL)
+        rcu_retire_memory(old);
+}
+
+void key_table_insert(key_table_t *table, void *node){
+    key_slots_t *array;
+    unsigned int i, mask;
+    int key = KEY_OF(table, node), hole = -1;
+
+    /*keep live entries and tombstones at or below one half of the slots
+    so probe runs stay short*/
+    if(table->array == NULL || 2 * (table->used + 1) > table->array->capacity)
+        key_table_rebuild(table);
+    array = table->array;
+    mask = array->capacity - 1;
+    for(i = key_table_hash(key, array->capacity); array->slots[i] != NULL; i = (i + 1) & mask){
+        if(array->slots[i] == KEY_TOMBSTONE){
+            if(hole < 0)
+                hole = i;
+        } else if(KEY_OF(table, array->slots[i]) == key){
+            __atomic_store_n(&array->slots[i], node, __ATOMIC_RELEASE);
+            return;
+        }
+    }
+    /*the key is not in the run, so its first tombstone can take it*/
+    if(hole >= 0)
+        i = hole;
+    else
+        table->used++;
+    __atomic_store_n(&array->slots[i], node, __ATOMIC_RELEASE);
+    table->count++;
+}
+
+void key_table_remove(key_table_t *table, int key){
+    key_slots_t *array = table->array;
+    unsigned int i, mask;
+
+    if(table->count == 0)
+        return;
+    mask = array->capacity - 1;
+    for(i = key_table_hash(key, array->capacity); array->slots[i] != NULL; i = (i + 1) & mask){
+        if(array->slots[i] != KEY_TOMBSTONE && KEY_OF(table, array->slots[i]) == key){
+            /*the rest of the probe run stays where it is, so readers
+            probing meanwhile still find it*/
+            __atomic_store_n(&array->slots[i], KEY_TOMBSTONE, __ATOMIC_RELEASE);
+            table->count--;
+            return;
+        }
+    }
+}
+/*<><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><>*/
+/*<><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><>  TYPE BUCKET FUNCTIONS*/
+/*<><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><>*/
+static unsigned int bucket_hash(int msg_type, int capacity){
+    return ((unsigned int) msg_type * 2654435769u) & (capacity - 1);
+}
+
+type_bucket_t * bucket_find(alarm_shard_t *shard, int msg_type){
+    type_bucket_t **buckets, *bucket;
+    unsigned int sequence;
+    int capacity;
+
+    do {
+        while((sequence = __atomic_load_n(&shard->bucket_sequence, __ATOMIC_ACQUIRE)) & 1)
+            sched_yield();
+        capacity = __atomic_load_n(&shard->bucket_capacity, __ATOMIC_ACQUIRE);
+        buckets = __atomic_load_n(&shard->buckets, __ATOMIC_ACQUIRE);
+        if(buckets == NULL)
+            return NULL;
+        for(bucket = __atomic_load_n(&buckets[bucket_hash(msg_type, capacity)], __ATOMIC_ACQUIRE);
+            bucket != NULL; bucket = __atomic_load_n(&bucket->link, __ATOMIC_ACQUIRE)){
+            if(bucket->type == msg_type)
+                return bucket;
+        }
+        /*a miss only counts if the chains were not relinked meanwhile*/
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while(__atomic_load_n(&shard->bucket_sequence, __ATOMIC_RELAXED) != sequence);
+    return NULL;
+}
+
+static void bucket_grow(alarm_shard_t *shard){
+    type_bucket_t **old = shard->buckets, **buckets, *bucket, *next;
+    int old_capacity = shard->bucket_capacity, capacity, j;
+
+    capacity = shard->bucket_capacity ? shard->bucket_capacity * 2 : 64;
+    buckets = (type_bucket_t **) calloc(capacity, sizeof(type_bucket_t *));
+    if (buckets == NULL)
+        errno_abort ("Allocate type_buckets");
+    /*relinking moves buckets between chains, a reader that misses a
+    bucket meanwhile sees the odd sequence and looks again*/
+    __atomic_add_fetch(&shard->bucket_sequence, 1, __ATOMIC_SEQ_CST);
+    for(j = 0; j < old_capacity; j++){
+        for(bucket = old[j]; bucket != NULL; bucket = next){
+            next = bucket->link;
+            __atomic_store_n(&bucket->link, buckets[bucket_hash(bucket->type, capacity)], __ATOMIC_RELEASE);
+            __atomic_store_n(&buckets[bucket_hash(bucket->type, capacity)], bucket, __ATOMIC_RELEASE);
+        }
+    }
+    __atomic_store_n(&shard->buckets, buckets, __ATOMIC_RELEASE);
+    __atomic_store_n(&shard->bucket_capacity, capacity, __ATOMIC_RELEASE);
+    __atomic_add_fetch(&shard->bucket_sequence, 1, __ATOMIC_RELEASE);
+    rcu_retire_memory(old);
+}
+
+static void bucket_reclaim(rcu_head_t *head){
+    pool_free(POOL_BUCKET, (char *) head - offsetof(type_bucket_t, rcu));
+}
+
+void bucket_add(alarm_shard_t *shard, alarm_t *alarm){
+    type_bucket_t *bucket = bucket_find(shard, alarm->type);
+    alarm_t **last, *prev;
+
+    if(bucket == NULL){
+        if(shard->bucket_count + 1 > shard->bucket_capacity)
+            bucket_grow(shard);
+        bucket = (type_bucket_t *) pool_alloc(POOL_BUCKET);
+        bucket->type = alarm->type;
+        bucket->active = 0;
+        bucket->alarms = NULL;
+        bucket->tail = &bucket->alarms;
+        bucket->link = shard->buckets[bucket_hash(alarm->type, shard->bucket_capacity)];
+        __atomic_store_n(&shard->buckets[bucket_hash(alarm->type, shard->bucket_capacity)], bucket, __ATOMIC_RELEASE);
+        shard->bucket_count++;
+    }
+    alarm->bucket = bucket;
+    /*the bucket is kept in message number order so the displays can
+    merge the shards. numbers mostly come in rising, so the place is
+    searched backwards from the tail*/
+    last = bucket->tail;
+    while(last != &bucket->alarms
+          && (prev = (alarm_t *) ((char *) last - offsetof(alarm_t, type_next)))->number > alarm->number)
+        last = prev->type_pprev;
+    alarm->type_next = *last;
+    alarm->type_pprev = last;
+    if(*last != NULL)
+        (*last)->type_pprev = &alarm->type_next;
+    else
+        bucket->tail = &alarm->type_next;
+    __atomic_store_n(last, alarm, __ATOMIC_RELEASE);
+    if(ALARM_LIVE(ALARM_STATE(alarm)))
+        __atomic_add_fetch(&bucket->active, 1, __ATOMIC_RELEASE);
+}
+
+/*drops one from a bucket's active count, the display thread of the
+type is queued for reaping when the count reaches zero*/
+static void bucket_release_active(type_bucket_t *bucket){
+    if(__atomic_sub_fetch(&bucket->active, 1, __ATOMIC_ACQ_REL) == 0)
+        queue_thread_reap(bucket->type);
+}
+
+void bucket_remove(alarm_shard_t *shard, alarm_t *alarm){
+    type_bucket_t *bucket = alarm->bucket, **last;
+
+    if(bucket == NULL)
+        return;
+    /*type_next is left alone for a reader standing on the alarm*/
+    __atomic_store_n(alarm->type_pprev, alarm->type_next, __ATOMIC_RELEASE);
+    if(alarm->type_next != NULL)
+        alarm->type_next->type_pprev = alarm->type_pprev;
+    else
+        bucket->tail = alarm->type_pprev;
+    /*alarm_detach settled the alarm, it left the active count then.
+    alarm->bucket is kept, a lock-free cancel that settled the alarm
+    first may still be about to release it, and the bucket stays
+    allocated until that read section ends*/
+
+    if(bucket->alarms != NULL)
+        return;
+    /*the last alarm of this type is gone, drop the bucket*/
+    for(last = &shard->buckets[bucket_hash(bucket->type, shard->bucket_capacity)]; *last != bucket; last = &(*last)->link)
+        ;
+    __atomic_store_n(last, bucket->link, __ATOMIC_RELEASE);
+    shard->bucket_count--;
+    rcu_retire(&bucket->rcu, bucket_reclaim);
+}
+
+int alarm_settle(alarm_t *alarm, int state){
+    int from = ALARM_STATE(alarm);
+
+    do {
+        /*only one thread gets an alarm out of the live states*/
+        if(!ALARM_LIVE(from))
+            return 0;
+    } while(!__atomic_compare_exchange_n(&alarm->state, &from, state, 1,
+                                         __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+    if(alarm->bucket != NULL)
+        bucket_release_active(alarm->bucket);
+    else if(alarm_store == STORE_LOCKFREE)
+        queue_thread_reap(alarm->type);     /*no buckets, the reaper counts again*/
+    return 1;
+}
+
+int alarm_mark_done(alarm_shard_t *shard, alarm_t *alarm){
+    if(!alarm_settle(alarm, ALARM_EXPIRED))
+        return 0;
+    __atomic_add_fetch(&shard->done_count, 1, __ATOMIC_RELAXED);
+    return 1;
+}
+/*<><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><>*/
+/*<><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><>  ALARM_HEAP FUNCTIONS*/
+/*<><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><>*/
+static void heap_set(alarm_shard_t *shard, int index, alarm_t *alarm){
+    shard->heap[index] = alarm;
+    alarm->heap_index = index;
+}
+
+static void heap_sift_up(alarm_shard_t *shard, int index){
+    alarm_t *alarm = shard->heap[index];
+    while(index > 0){
+        int parent = (index - 1) / 2;
+        if(shard->heap[parent]->deadline <= alarm->deadline)
+            break;
+        heap_set(shard, index, shard->heap[parent]);
+        index = parent;
+    }
+    heap_set(shard, index, alarm);
+}
+
+static void heap_sift_down(alarm_shard_t *shard, int index){
+    alarm_t *alarm = shard->heap[index];
+    while(1){
+        int child = 2 * index + 1;
+        if(child >= shard->heap_size)
+            break;
+        if(child + 1 < shard->heap_size && shard->heap[child + 1]->deadline < shard->heap[child]->deadline)
+            child++;
+        if(alarm->deadline <= shard->heap[child]->deadline)
+            break;
+        heap_set(shard, index, shard->heap[child]);
+        index = child;
+    }
+    heap_set(shard, index, alarm);
+}
+
+void heap_insert(alarm_shard_t *shard, alarm_t *alarm){
+    if(shard->heap_size == shard->heap_capacity){
+        shard->heap_capacity = shard->heap_capacity ? shard->heap_capacity * 2 : 64;
+        shard->heap = (alarm_t **) realloc(shard->heap, shard->heap_capacity * sizeof(alarm_t *));
+        if (shard->heap == NULL)
+            errno_abort ("Allocate alarm_heap");
+    }
+    heap_set(shard, shard->heap_size++, alarm);
+    heap_sift_up(shard, alarm->heap_index);
+}
+
+void heap_remove(alarm_shard_t *shard, alarm_t *alarm){
+    int index = alarm->heap_index;
+    alarm_t *last;
+
+    if(index < 0)
+        return;
+    alarm->heap_index = -1;
+    last = shard->heap[--shard->heap_size];
+    if(index == shard->heap_size)
+        return;
+    /*move the last element into the hole and restore the heap order
+    in whichever direction it is violated*/
+    heap_set(shard, index, last);
+    if(index > 0 && shard->heap[(index - 1) / 2]->deadline > last->deadline)
+        heap_sift_up(shard, index);
+    else
+        heap_sift_down(shard, index);
+}
+
+alarm_t * heap_peek(alarm_shard_t *shard){
+    return shard->heap_size > 0 ? shard->heap[0] : NULL;
+}
+/*<><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><>*/
+/*<><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><>  TIMING WHEEL FUNCTIONS*/
+/*<><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><>*/
+static void wheel_link(alarm_t **head, alarm_t *alarm){
+    alarm->wheel_next = *head;
+    if(*head != NULL)
+        (*head)->wheel_pprev = &alarm->wheel_next;
+    *head = alarm;
+    alarm->wheel_pprev = head;
+}
+
+void wheel_insert(alarm_shard_t *shard, alarm_t *alarm){
+    /*an alarm expires on the first millisecond tick at or after its
+    deadline, so it is never early and at most a millisecond late*/
+    long expires = (alarm->deadline + 999999) / 1000000;
+    long delta;
+    int level;
+
+    if(shard->wheel_time == 0)
+        shard->wheel_time = monotonic_ns() / 1000000;
+    delta = expires - shard->wheel_time;
+    if(delta <= 0){
+        wheel_link(&shard->wheel_due, alarm);
+        return;
+    }
+    /*pick the lowest level whose whole revolution still reaches the
+    deadline, the slot is then found from the deadline itself*/
+    for(level = 0; level < WHEEL_LEVELS; level++){
+        if(delta < wheel_span[level] * wheel_slots[level]){
+            wheel_link(&shard->wheel[level][(expires / wheel_span[level]) % wheel_slots[level]], alarm);
+            return;
+        }
+    }
+    wheel_link(&shard->wheel_overflow, alarm);
+}
+
+void wheel_remove(alarm_t *alarm){
+    if(alarm->wheel_pprev == NULL)
+        return;
+    *alarm->wheel_pprev = alarm->wheel_next;
+    if(alarm->wheel_next != NULL)
+        alarm->wheel_next->wheel_pprev = alarm->wheel_pprev;
+    alarm->wheel_next = NULL;
+    alarm->wheel_pprev = NULL;
+}
+
+/*refiles every alarm of a slot, used when an upper level slot comes due*/
+static void wheel_cascade(alarm_shard_t *shard, alarm_t **head){
+    alarm_t *alarm, *next;
 
-    while(1){
-        msg_number = -1;
-        alarm_reader_semaphore_lock();
-            for(next = alarm_list; next != NULL; next = next->link){ 
-                if(next->is_done){
-                    msg_number = next->number;
-                    break;
-                }
+    alarm = *head;
+    *head = NULL;
+    for(; alarm != NULL; alarm = next){
+        next = alarm->wheel_next;
+        alarm->wheel_pprev = NULL;
+        wheel_insert(shard, alarm);
+    }
+}
+
+/*the first tick after wheel_time on which something happens: a level 0
+slot comes due, an upper level slot is cascaded or the top level turns
+over with alarms in the overflow. 0 if the wheel is empty*/
+static long wheel_next_tick(alarm_shard_t *shard){
+    long turn, tick, next = 0;
+    int level, k;
+
+    for(level = 0; level < WHEEL_LEVELS; level++){
+        turn = shard->wheel_time / wheel_span[level];
+        for(k = 1; k <= wheel_slots[level]; k++){
+            tick = (turn + k) * wheel_span[level];
+            if(next != 0 && tick >= next)
+                break;
+            if(shard->wheel[level][(turn + k) % wheel_slots[level]] != NULL){
+                next = tick;
+                break;
             }
-        alarm_reader_semaphore_release();
-        if(msg_number < 0)
-            break;            
-        remove_from_alarm_list(next->number,0);
-    }    
+        }
+    }
+    if(shard->wheel_overflow != NULL){
+        tick = (shard->wheel_time / wheel_span[WHEEL_LEVELS - 1] + 1) * wheel_span[WHEEL_LEVELS - 1];
+        if(next == 0 || tick < next)
+            next = tick;
+    }
+    return next;
+}
+
+void wheel_advance(alarm_shard_t *shard, long now){
+    alarm_t **slot;
+    long tick;
+    int level;
+
+    if(shard->wheel_time == 0)
+        shard->wheel_time = now;
+    while(shard->wheel_time < now){
+        /*the idle ticks in between are skipped, the wheel jumps to the
+        next tick that has a slot to empty or cascade. the cascades of
+        the boundaries it jumps over would only find empty slots*/
+        tick = wheel_next_tick(shard);
+        if(tick == 0 || tick > now){
+            shard->wheel_time = now;
+            break;
+        }
+        shard->wheel_time = tick;
+        /*cascade from the top down so an alarm falling out of the hours
+        level can land in a minutes slot that comes due on this same tick*/
+        for(level = WHEEL_LEVELS - 1; level > 0; level--){
+            if(shard->wheel_time % wheel_span[level] != 0)
+                continue;
+            if(level == WHEEL_LEVELS - 1)
+                wheel_cascade(shard, &shard->wheel_overflow);
+            wheel_cascade(shard, &shard->wheel[level][(shard->wheel_time / wheel_span[level]) % wheel_slots[level]]);
+        }
+        /*everything in the level 0 slot of this tick is due*/
+        slot = &shard->wheel[0][shard->wheel_time % wheel_slots[0]];
+        while(*slot != NULL){
+            alarm_t *alarm = *slot;
+            wheel_remove(alarm);
+            wheel_link(&shard->wheel_due, alarm);
+        }
+    }
 }
 /*<><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><>*/
-/*<><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><>  TYPE B THREAD_LIST FUNCTIONS*/
+/*<><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><>  EXPIRY ENGINE FUNCTIONS*/
 /*<><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><>*/
-void thread_reader_semaphore_lock(){
-  sem_wait(&t_readCountAccess);
-        t_readCount++;
-        if(t_readCount==1) {
-            sem_wait(&t_threadListAccess);
-        }
-  sem_post(&t_readCountAccess);
+void expiry_schedule(alarm_shard_t *shard, alarm_t *alarm){
+#if TIMING_WHEEL
+    wheel_insert(shard, alarm);
+    shard->wheel_size++;
+#else
+    heap_insert(shard, alarm);
+#endif
 }
 
-void thread_reader_semaphore_release(){
-  sem_wait(&t_readCountAccess);
-        t_readCount--;
-        /*the last thread releases the database for writting*/
-        if(t_readCount==0){
-            sem_post(&t_threadListAccess);
-        }
-  sem_post(&t_readCountAccess);
+void expiry_cancel(alarm_shard_t *shard, alarm_t *alarm){
+#if TIMING_WHEEL
+    if(alarm->wheel_pprev != NULL)
+        shard->wheel_size--;
+    wheel_remove(alarm);
+#else
+    heap_remove(shard, alarm);
+#endif
 }
 
+alarm_t * expiry_next_due(alarm_shard_t *shard, long now){
+    alarm_t *alarm;
+#if TIMING_WHEEL
+    wheel_advance(shard, now / 1000000);
+    alarm = shard->wheel_due;
+    if(alarm != NULL){
+        wheel_remove(alarm);
+        shard->wheel_size--;
+    }
+#else
+    alarm = heap_peek(shard);
+    if(alarm == NULL || alarm->deadline > now)
+        return NULL;
+    heap_remove(shard, alarm);
+#endif
+    return alarm;
+}
+
+long expiry_next_deadline(alarm_shard_t *shard){
+#if TIMING_WHEEL
+    if(shard->wheel_due != NULL)
+        return shard->wheel_time * 1000000;
+    if(shard->wheel_size == 0)
+        return 0;
+    return wheel_next_tick(shard) * 1000000;
+#else
+    alarm_t *alarm = heap_peek(shard);
+    return alarm ? alarm->deadline : 0;
+#endif
+}
+/*<><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><>*/
+/*<><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><>  TYPE B THREAD_LIST FUNCTIONS*/
+/*<><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><>*/
 void prt_thread_list(){
   /*assumes thread list has been locked before call*/
   #ifdef DEBUG        
-          thread_ds *s;
+          int i;
           printf("List of Threads:\n");   
         
-          for(s = thread_list; s != NULL; s = s->link)
-              printf("Thread Type: %d \n",s->type);
+          for(i = 0; i < thread_count; i++)
+              printf("Thread Type: %d \n",thread_list[i]->type);
   #endif
 }
 
-void remove_from_thread_list(int msg_type){
-  thread_ds *temp, *prev;
-    sem_wait(&t_threadListAccess); /*lock*/
-
-    /* thread_ds *temp = thread_list, *prev;*/
-    temp = thread_list;
-
-    if (temp != NULL && temp->type == msg_type){
-        thread_list = temp->link;
-        free(temp);
-    } else {
-        while(temp != NULL && temp->type != msg_type){
-            prev = temp;
-            temp = temp->link;
-        }
+thread_ds * thread_find(int msg_type){
+    if(msg_type >= 0 && msg_type < THREAD_DENSE_TYPES)
+        return thread_slots[msg_type];
+    return (thread_ds *) key_table_find(&thread_table, msg_type);
+}
 
-        if(temp != NULL){
-        prev->link = temp->link;
-        free(temp);
+void remove_from_thread_list(int msg_type){
+  thread_ds *temp;
+    rw_write_lock(&thread_list_lock); /*lock*/
+
+    temp = thread_find(msg_type);
+    if(temp != NULL){
+        if(msg_type < THREAD_DENSE_TYPES){
+            thread_slots[msg_type] = NULL;
+            __atomic_fetch_and(&thread_active[msg_type / BITS_PER_WORD],
+                               ~(1UL << (msg_type % BITS_PER_WORD)), __ATOMIC_RELEASE);
+        } else {
+            key_table_remove(&thread_table, msg_type);
         }
+        /*move the last entry into the hole to keep thread_list dense*/
+        thread_list[temp->position] = thread_list[--thread_count];
+        thread_list[temp->position]->position = temp->position;
+        /*there is no display worker to notice and say so itself*/
+        if(alarm_runtime == RUNTIME_EPOLL && temp->is_created)
+            printf("Type A Alarm Request Processed at <%ld>: Periodic Display Thread For Message Type (%d) Terminated: No more Alarm Requests For Message Type (%d).\n",
+            time(NULL), msg_type, msg_type );
+        pool_free(POOL_THREAD, temp);
     }
-    sem_post(&t_threadListAccess);
+    rw_write_unlock(&thread_list_lock);
 }
 
 /*returns 1 if thread exists and 0 if it doesn't*/
 int thread_exists(int msg_type){
-  thread_ds *s;
   int does_exist = 0;
-  thread_reader_semaphore_lock();
+  if(msg_type >= 0 && msg_type < THREAD_DENSE_TYPES){
+      /*a single load, display workers poll this every second*/
+      return (__atomic_load_n(&thread_active[msg_type / BITS_PER_WORD], __ATOMIC_ACQUIRE)
+              >> (msg_type % BITS_PER_WORD)) & 1;
+  }
+  rw_read_lock(&thread_list_lock);
     /*lock <<<<<<<<<<<<<<<<<<<<<>>>>>>>>>>>>>>>>>>*/
-    for(s = thread_list; s != NULL; s = s->link){
-        if(s->type == msg_type){
-            does_exist++;
-        }
+    if(key_table_find(&thread_table, msg_type) != NULL){
+        does_exist++;
     }
     /*unlock <<<<<<<<<<<<<<<<<<<<<>>>>>>>>>>>>>>>>>>*/
-  thread_reader_semaphore_release();
+  rw_read_unlock(&thread_list_lock);
   return does_exist;
 }
 
@@ -439,50 +2927,57 @@ int thread_has_active_alarm(int msg_type){
 
 /*WRITER METHOD TO ADD THREAD INFO INTO thread_list*/
 void * add_to_thread_list(void * args){
-    int msg_type = (int) *((int *) args);
+    int msg_type = (int) (long) args;
+    thread_ds *next;
     
-  sem_wait(&t_threadListAccess); /*lock*/
+  rw_write_lock(&thread_list_lock); /*lock*/
     
-    if(thread_list == NULL) {
-            thread_list = (thread_ds*) malloc(sizeof(thread_ds));
-            thread_list->type = msg_type;                    
-            // thread_list->flag = 0;
-            thread_list->is_created = 0; 
-            thread_list->link = NULL;
-    }
-    else {      
-        thread_ds *next = thread_list;
-        while(next->link != NULL){
-            next = next->link;
-        }
-        next->link = (thread_ds*) malloc(sizeof (thread_ds));
-        next = next->link;
+    if(thread_find(msg_type) == NULL) {
+        if(thread_count == thread_capacity){
+            thread_capacity = thread_capacity ? thread_capacity * 2 : 64;
+            thread_list = (thread_ds **) realloc(thread_list, thread_capacity * sizeof(thread_ds *));
+            if (thread_list == NULL)
+                errno_abort ("Allocate thread_list");
+        }
+        next = (thread_ds*) pool_alloc(POOL_THREAD);
         next->type = msg_type;  
         next->is_created = 0;    
         // next->flag = 0;
-        next->link = NULL;
+        next->position = thread_count;
+        thread_list[thread_count++] = next;
+        if(msg_type >= 0 && msg_type < THREAD_DENSE_TYPES){
+            thread_slots[msg_type] = next;
+            __atomic_fetch_or(&thread_active[msg_type / BITS_PER_WORD],
+                              1UL << (msg_type % BITS_PER_WORD), __ATOMIC_RELEASE);
+        } else {
+            key_table_insert(&thread_table, next);
+        }
     }
     prt_thread_list();
-  sem_post(&t_threadListAccess); /*unlock*/
+  rw_write_unlock(&thread_list_lock); /*unlock*/
+  /*the type's alarms may all have expired between the Type B check and
+  now, in which case no zero crossing is left to queue the reap*/
+  queue_thread_reap(msg_type);
+  /*alarm_thread starts the display*/
+  alarm_thread_wake();
+}
+
+void queue_thread_reap(int msg_type){
+    removal_ds *node = (removal_ds*) pool_alloc(POOL_REMOVAL);
+    node->number = msg_type;
+    mpsc_push(&reap_queue, node);
 }
 
 void remove_threads_if_no_active_alarm(){ /*reads thread_list*/
-    thread_ds *next;
-    int msg_type;
+    removal_ds *next, *link;
     
-    while(1){
-        msg_type = -1;
-        thread_reader_semaphore_lock();
-            for(next = thread_list; next != NULL; next = next->link){ 
-                if(!thread_has_active_alarm(next->type)){
-                    msg_type = next->type;
-                    break;
-                }
-            }
-        thread_reader_semaphore_release();
-        if(msg_type<0)
-            break;            
-        remove_from_thread_list(msg_type);
+    /*only the types whose count reached zero are looked at. the count is
+    read again, a type that got new alarms after it was queued is kept*/
+    for(next = mpsc_take_all(&reap_queue); next != NULL; next = link){
+        link = next->link;
+        if(thread_exists(next->number) && !thread_has_active_alarm(next->number))
+            remove_from_thread_list(next->number);
+        pool_free(POOL_REMOVAL, next);
     }
 }
 
@@ -490,335 +2985,906 @@ void remove_threads_if_no_active_alarm(){ /*reads thread_list*/
 void check_thread_list_and_create_thread(){
     
     thread_ds *next;
-    int status;
-    pthread_t print_thread;
+    int i;
 
-    thread_reader_semaphore_lock();
-        for(next = thread_list; next != NULL; next = next->link){                                  
+    rw_read_lock(&thread_list_lock);
+        for(i = 0; i < thread_count; i++){                                  
+            next = thread_list[i];
             if (!next->is_created){  
                 next->is_created = 1;                
-                status = pthread_create(&print_thread,NULL,periodic_display_threads,&next->type);
-                if (status != 0)
-                    err_abort (status, "periodic_display_threads not created!\n");
+                /*the event loop displays every created type itself*/
+                if (alarm_runtime == RUNTIME_THREADS){
+                    /*the job holds the type by value, the thread_ds entry can
+                    be freed and reused while the job is still queued*/
+                    display_job_add(next->type);
+                }
                 printf("Type B Alarm Request Processed at <%ld>: New Periodic Display Thread For Message Type (%d) Created.\n",
                         time(NULL),next->type);
             }
         }
-    thread_reader_semaphore_release();
+    rw_read_unlock(&thread_list_lock);
 }
 /*<><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><>*/
 /*<><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><>  TYPE C REMOVAL_LIST FUNCTIONS*/
 /*<><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><>*/
-void removal_reader_semaphore_lock(){
-    sem_wait(&r_readCountAccess);
-        r_readCount++;
-        if(r_readCount==1) {
-            sem_wait(&r_threadListAccess);
-        }
-  sem_post(&r_readCountAccess);
-}
-
-void removal_reader_semaphore_release(){
-    sem_wait(&r_readCountAccess);
-        r_readCount--;
-        /*the last thread releases the database for writting*/
-        if(r_readCount==0){
-            sem_post(&r_threadListAccess);
-        }
-  sem_post(&r_readCountAccess);
-}
-
-void prt_removal_list(){
-  /*assumes thread list has been locked before call*/
+void prt_removal_list(removal_ds *batch){
   #ifdef DEBUG        
           removal_ds *s;
           printf("List of Removal_Requests:\n");
-          for(s = removal_list; s != NULL; s = s->link)
+          for(s = batch; s != NULL; s = s->link)
               printf("Msg_Number: %d\n",s->number);
   #endif
 }
 
-/*returns 1 if thread exists and 0 if it doesn't*/
+/*returns 1 if a removal request exists and 0 if it doesn't*/
 int remove_request_exists(int msg_number){
-  removal_ds *s;
+  alarm_t *alarm;
   int does_exist = 0;
-  removal_reader_semaphore_lock();  
-  /*lock <<<<<<<<<<<<<<<<<<<<<>>>>>>>>>>>>>>>>>>*/
-  for(s = removal_list; s != NULL; s = s->link){
-    if(s->number == msg_number){
-      does_exist = 1;
+  /*the pending flag lives on the alarm, so the queue itself is never
+  searched*/
+  rcu_read_lock();
+    alarm = store_find(msg_number);
+    if(alarm != NULL){
+        does_exist = ALARM_STATE(alarm) == ALARM_CANCELLED;
     }
-  }
-  /*unlock <<<<<<<<<<<<<<<<<<<<<>>>>>>>>>>>>>>>>>>*/
-  removal_reader_semaphore_release();  
+  rcu_read_unlock();
   return does_exist;
 }
 
+void mpsc_push(removal_ds **queue, removal_ds *node){
+  removal_ds *head;
+  /*wait-free push: one exchange on the head, then publish the link*/
+  node->link = REMOVAL_LINK_PENDING;
+  head = __atomic_exchange_n(queue, node, __ATOMIC_ACQ_REL);
+  __atomic_store_n(&node->link, head, __ATOMIC_RELEASE);
+}
+
+removal_ds * mpsc_take_all(removal_ds **queue){
+    removal_ds *next, *link, *batch = NULL;            
+
+    /*take every queued node at once, producers keep pushing onto
+    the now empty queue*/
+    next = __atomic_exchange_n(queue, NULL, __ATOMIC_ACQUIRE);
+    /*the queue is newest first, reverse it so the nodes come out in
+    the order they were pushed*/
+    while(next != NULL){
+        while((link = __atomic_load_n(&next->link, __ATOMIC_ACQUIRE)) == REMOVAL_LINK_PENDING)
+            sched_yield();
+        next->link = batch;
+        batch = next;
+        next = link;
+    }
+    return batch;
+}
+
 void remove_alarms_in_removal_list(){ /*reads alarm_list*/
-    int msg_number;   
-    removal_ds *next;            
-    removal_reader_semaphore_lock();  
-        for(next = removal_list; next != NULL; next = next->link){
-            remove_from_alarm_list(next->number,1);            
-        }        
-        /*all alarms specified in the removal_list will be removed so
-        the removal list must be cleared.*/
-        removal_list = NULL;
-    removal_reader_semaphore_release();  
+    removal_ds *next, *link, *batch;            
+
+    batch = mpsc_take_all(&removal_queue);
+    if(batch == NULL)
+        return;
+    prt_removal_list(batch);
+    remove_batch_from_alarm_list(batch);
+    /*the drained nodes go back to the pool to be reused*/
+    for(next = batch; next != NULL; next = link){
+        link = next->link;
+        pool_free(POOL_REMOVAL, next);
+    }        
 }
 
 
-/*WRITER METHOD TO ADD INTO removal_list*/
+/*WRITER METHOD TO ADD INTO removal_queue*/
 void add_to_removal_list(int msg_number){
-  sem_wait(&r_threadListAccess); /*lock*/
-  if(removal_list == NULL) {
-          removal_list = (removal_ds*) malloc(sizeof(removal_ds));
-          removal_list->number = msg_number;
-          removal_list->link = NULL;
-  }
-  else {
-      removal_ds *next = removal_list;
-      while(next->link != NULL){
-          next = next->link;
-      }
-      next->link = (removal_ds*) malloc(sizeof (removal_ds));
-      next = next->link;
-      next->number = msg_number;            
-      next->link = NULL;
-  }
-  prt_removal_list();
-  sem_post(&r_threadListAccess); /*unlock*/
+  removal_ds *node;
+  alarm_t *alarm;
+
+  /*the alarm is cancelled right away by a CAS on its state, displays
+  stop printing it before the removal queue unlinks it. the read section
+  keeps the alarm and its bucket allocated, no shard lock is taken. a
+  cancel that loses to a replacement is still carried out, the removal
+  queue removes whatever alarm has the number*/
+  rcu_read_lock();
+    alarm = store_find(msg_number);
+    if(alarm != NULL)
+        alarm_settle(alarm, ALARM_CANCELLED);
+  rcu_read_unlock();
+
+  node = (removal_ds*) pool_alloc(POOL_REMOVAL);
+  node->number = msg_number;
+  mpsc_push(&removal_queue, node);
+  alarm_thread_wake();
+}
+
+/*<><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><>*/
+/*<><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><>  LOCK BENCHMARK*/
+/*<><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><>*/
+#define BENCH_READERS       4
+#define BENCH_WRITERS       2
+#define BENCH_SECONDS       1
+#define BENCH_READ_HOLD_NS  50000   /*a reader's traversal, about the cost of printing a few alarms*/
+#define BENCH_WRITE_HOLD_NS 5000
+#define BENCH_WRITE_GAP_NS  200000  /*time between two inserts of one writer*/
+#define BENCH_SAMPLES       100000
+
+typedef struct bench_writer_tag {
+    long      waits[BENCH_SAMPLES];  /*nanoseconds each lock took to acquire*/
+    int       count;
+} bench_writer_t;
+
+struct timespec bench_end;
+long  bench_reads;
+rw_lock_t bench_lock;
+
+static void bench_spin(long ns){
+    long until = monotonic_ns() + ns;
+    while(monotonic_ns() < until)
+        ;
 }
 
+static int bench_running(){
+    return monotonic_ns() < bench_end.tv_sec * 1000000000L + bench_end.tv_nsec;
+}
 
-/*WRITER METHOD TO REMOVE FROM removal_list*/
-/*
-void remove_from_removal_list(int msg_number){
-  removal_ds *temp, *prev;
+static void * bench_reader(void * arg){
+    long reads = 0;
+    while(bench_running()){
+        rw_read_lock(&bench_lock);
+            bench_spin(BENCH_READ_HOLD_NS);
+        rw_read_unlock(&bench_lock);
+        reads++;
+    }
+    __atomic_add_fetch(&bench_reads, reads, __ATOMIC_RELAXED);
+    return NULL;
+}
+
+static void * bench_writer(void * arg){
+    bench_writer_t *writer = (bench_writer_t *) arg;
+    long start;
+    while(bench_running() && writer->count < BENCH_SAMPLES){
+        start = monotonic_ns();
+        rw_write_lock(&bench_lock);
+            writer->waits[writer->count++] = monotonic_ns() - start;
+            bench_spin(BENCH_WRITE_HOLD_NS);
+        rw_write_unlock(&bench_lock);
+        bench_spin(BENCH_WRITE_GAP_NS);
+    }
+    return NULL;
+}
 
-    sem_wait(&r_threadListAccess);    
-        temp = removal_list;
+static int bench_compare(const void *a, const void *b){
+    long x = *(const long *) a, y = *(const long *) b;
+    return x < y ? -1 : x > y;
+}
 
-        if (temp != NULL && temp->number == msg_number){
-            removal_list = temp->link;
-            free(temp);
-        } else {
-            while(temp != NULL && temp->number != msg_number){
-                prev = temp;
-                temp = temp->link;
+void alarm_lock_benchmark(){
+    /*every protocol on the sem backend and the two of the futex and
+    pthread backends*/
+    static const int configs[][2] = {
+        {RW_BACKEND_SEM, RW_READER_PREF}, {RW_BACKEND_SEM, RW_WRITER_PREF}, {RW_BACKEND_SEM, RW_FAIR},
+        {RW_BACKEND_FUTEX, RW_READER_PREF}, {RW_BACKEND_FUTEX, RW_WRITER_PREF},
+        {RW_BACKEND_PTHREAD, RW_READER_PREF}, {RW_BACKEND_PTHREAD, RW_WRITER_PREF}
+    };
+    static bench_writer_t writers[BENCH_WRITERS];
+    static long waits[BENCH_WRITERS * BENCH_SAMPLES];
+    pthread_t threads[BENCH_READERS + BENCH_WRITERS];
+    int config, i, j, n;
+    long sum;
+
+    printf("alarm_list lock latency, %d readers holding %d us, %d writers every %d us, %d s per lock\n",
+           BENCH_READERS, BENCH_READ_HOLD_NS / 1000, BENCH_WRITERS, BENCH_WRITE_GAP_NS / 1000, BENCH_SECONDS);
+    for(config = 0; config < sizeof(configs) / sizeof(configs[0]); config++){
+        rw_lock_init(&bench_lock, "bench", configs[config][0], configs[config][1]);
+        bench_reads = 0;
+        clock_gettime(CLOCK_MONOTONIC, &bench_end);
+        bench_end.tv_sec += BENCH_SECONDS;
+        for(i = 0; i < BENCH_WRITERS; i++){
+            writers[i].count = 0;
+            pthread_create(&threads[i], NULL, bench_writer, &writers[i]);
+        }
+        for(i = 0; i < BENCH_READERS; i++)
+            pthread_create(&threads[BENCH_WRITERS + i], NULL, bench_reader, NULL);
+        for(i = 0; i < BENCH_READERS + BENCH_WRITERS; i++)
+            pthread_join(threads[i], NULL);
+
+        n = 0;
+        sum = 0;
+        for(i = 0; i < BENCH_WRITERS; i++){
+            for(j = 0; j < writers[i].count; j++){
+                waits[n++] = writers[i].waits[j];
+                sum += writers[i].waits[j];
             }
+        }
+        qsort(waits, n, sizeof(long), bench_compare);
+        printf("Backend : %s, Policy : %s, Reads : %ld, Writes : %d, Write Wait Avg : %ld us, P50 : %ld us, P99 : %ld us, Max : %ld us\n",
+               rw_backend_names[bench_lock.backend],
+               rw_policy_names[bench_lock.policy],
+               bench_reads, n, n ? sum / n / 1000 : 0,
+               n ? waits[n / 2] / 1000 : 0, n ? waits[n * 99 / 100] / 1000 : 0, n ? waits[n - 1] / 1000 : 0);
+    }
+}
+
+#define BENCH_STORE_KEYS     4096
+#define BENCH_STORE_MAX      4       /*most producer threads*/
+
+static void * bench_producer(void * arg){
+    unsigned int seed = (unsigned int) (long) arg;
+    long ops = 0;
+    int number;
+
+    while(bench_running()){
+        number = rand_r(&seed) % BENCH_STORE_KEYS + 1;
+        /*half inserts, half removes, so the store stays about half full*/
+        if(rand_r(&seed) & 1){
+            int replaced_type;
+            store_insert(alarm_create(3600 * 1000L, number % 8 + 1, number, "bench"), &replaced_type);
+        } else {
+            store_remove(number);
+        }
+        ops++;
+    }
+    return (void *) ops;
+}
 
-            if(temp != NULL){
-                prev->link = temp->link;
-                free(temp);
+void alarm_store_benchmark(){
+    static const char *store_names[] = {"locked", "lockfree"};
+    pthread_t threads[BENCH_STORE_MAX];
+    void *ops;
+    int store, producers, i;
+    long total;
+
+    printf("alarm store throughput, random inserts and removes over %d message numbers, %d shards, %d s per run\n",
+           BENCH_STORE_KEYS, alarm_shard_count, BENCH_SECONDS);
+    for(producers = 1; producers <= BENCH_STORE_MAX; producers *= 2){
+        for(store = STORE_LOCKED; store <= STORE_LOCKFREE; store++){
+            alarm_store = store;
+            clock_gettime(CLOCK_MONOTONIC, &bench_end);
+            bench_end.tv_sec += BENCH_SECONDS;
+            for(i = 0; i < producers; i++)
+                pthread_create(&threads[i], NULL, bench_producer, (void *) (long) (i + 1));
+            /*the main thread stands in for alarm_thread and frees what
+            the producers retire*/
+            while(bench_running()){
+                rcu_reclaim();
+                usleep(1000);
             }
+            total = 0;
+            for(i = 0; i < producers; i++){
+                pthread_join(threads[i], &ops);
+                total += (long) ops;
+            }
+            /*empty the store for the next run*/
+            for(i = 1; i <= BENCH_STORE_KEYS; i++)
+                store_remove(i);
+            remove_threads_if_no_active_alarm();
+            rcu_reclaim();
+            printf("Store : %s, Producers : %d, Ops : %ld, Ops/s : %ld\n",
+                   store_names[store], producers, total, total / BENCH_SECONDS);
         }
-    sem_post(&r_threadListAccess);  
+    }
 }
-*/
 /*<><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><>*/
 /*<><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><>  REQUIRED METHODSS*/
 /*<><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><>*/
 
 
-void * periodic_display_threads(void * args){
-    int remaining_time;
-    alarm_t * next;
-    int message_type = (int) *((int *) args);
-     
+void display_workers_start(){
+    pthread_t thread;
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    int status, i;
+
+    display_workers = cores < 1 ? 1 : cores > DISPLAY_WORKERS_MAX ? DISPLAY_WORKERS_MAX : cores;
+    /*the pool lives as long as the process, nobody joins it*/
+    for (i = 0; i < display_workers; i++){
+        status = pthread_create(&thread,NULL,display_worker,NULL);
+        if (status != 0)
+            err_abort (status, "display_worker not created!\n");
+        pthread_detach(thread);
+    }
+    status = pthread_create(&thread,NULL,display_tick_thread,NULL);
+    if (status != 0)
+        err_abort (status, "display_tick_thread not created!\n");
+    pthread_detach(thread);
+}
+
+void display_job_add(int message_type){
+    removal_ds *job = (removal_ds*) pool_alloc(POOL_REMOVAL);
+
+    job->number = message_type;
+    job->link = NULL;
+    lock_mutex_lock(&display_mutex, &display_mutex_stats);
+        *display_run_tail = job;
+        display_run_tail = &job->link;
+        pthread_cond_signal(&display_cond);
+    lock_mutex_unlock(&display_mutex, &display_mutex_stats);
+    /*the first job starts the tick*/
+    if (__atomic_fetch_add(&display_jobs, 1, __ATOMIC_ACQ_REL) == 0)
+        futex_wake_all(&display_jobs);
+}
+
+void * display_worker(void * args){
+    removal_ds *job;
+    int message_type;
+
     while(1){
-        alarm_reader_semaphore_lock();
-            for (next = alarm_list; next != NULL; next = next->link){                                       
-                if (next->type == message_type && !next->is_done){  
-                    remaining_time = next->time - time(NULL);                    
-                    if (remaining_time >= 0 ){
-                        // printf("Alarm With Message Type (%d) and Message Number (%d) Displayed at <%ld>: <Type B>\n",
-                        //     message_type, next->number, time(NULL));
-                        printf("Printing message, Type : %d , Number : %d , Msg : %s , Tim : %ld\n",
-                        next->type,next->number, next->message, remaining_time);
-                        
-                    } else {
-                        next->is_done = 1;
-                        printf("ALARM IS NOW DONE\n");
-                    }
-                }
-            }
-        alarm_reader_semaphore_release();
-        if (!thread_exists(message_type)){
-            printf("Type A Alarm Request Processed at <%ld>: Periodic Display Thread For Message Type (%d) Terminated: No more Alarm Requests For Message Type (%d).\n",
-            time(NULL), message_type, message_type );
-            break;
+        lock_mutex_lock(&display_mutex, &display_mutex_stats);
+            while (display_run == NULL)
+                lock_cond_wait(&display_cond, &display_mutex, &display_mutex_stats, NULL);
+            job = display_run;
+            display_run = job->link;
+            if (display_run == NULL)
+                display_run_tail = &display_run;
+        lock_mutex_unlock(&display_mutex, &display_mutex_stats);
+
+        message_type = job->number;
+        display_type_alarms(message_type);
+        if (thread_exists(message_type)){
+            /*wait for the next tick*/
+            lock_mutex_lock(&display_mutex, &display_mutex_stats);
+                job->link = display_parked;
+                display_parked = job;
+            lock_mutex_unlock(&display_mutex, &display_mutex_stats);
+            continue;
+        }
+        printf("Type A Alarm Request Processed at <%ld>: Periodic Display Thread For Message Type (%d) Terminated: No more Alarm Requests For Message Type (%d).\n",
+        time(NULL), message_type, message_type );
+        pool_free(POOL_REMOVAL, job);
+        __atomic_sub_fetch(&display_jobs, 1, __ATOMIC_RELEASE);
+    }
+}
+
+void * display_tick_thread(void *arg){
+    struct timespec wake;
+    removal_ds *job;
+    long next = 0;
+
+    while(1){
+        /*no jobs to run, sleep until a type gets a display*/
+        while (__atomic_load_n(&display_jobs, __ATOMIC_ACQUIRE) == 0){
+            futex_wait(&display_jobs, 0);
+            next = 0;
         }
-        sleep(1);
+        /*the deadlines are absolute whole periods, so the tick does not
+        drift. a wake later than a whole period skips what it missed*/
+        if (next <= monotonic_ns())
+            next = (monotonic_ns() / DISPLAY_PERIOD_NS + 1) * DISPLAY_PERIOD_NS;
+        wake.tv_sec = next / 1000000000;
+        wake.tv_nsec = next % 1000000000;
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &wake, NULL) == EINTR)
+            ;
+        /*a job still running from the last tick is not parked and
+        skips this one*/
+        lock_mutex_lock(&display_mutex, &display_mutex_stats);
+            if (display_parked != NULL){
+                *display_run_tail = display_parked;
+                for (job = display_parked; job->link != NULL; job = job->link)
+                    ;
+                display_run_tail = &job->link;
+                display_parked = NULL;
+                pthread_cond_broadcast(&display_cond);
+            }
+        lock_mutex_unlock(&display_mutex, &display_mutex_stats);
+        next += DISPLAY_PERIOD_NS;
     }
 }
 
+void display_type_alarms(int message_type){
+    long remaining_time, now = monotonic_ns();
+    int i, state, lowest;
+    alarm_t *heads[ALARM_SHARDS_MAX], * next;
+
+    /*the printing happens in a read section, writers go ahead
+    meanwhile and nothing this thread can see is freed under it*/
+    rcu_read_lock();
+      /*only the alarms of this type are visited. each shard yields them
+      in message number order, the shards are merged like prt_alarm_list
+      merges the lists*/
+      for (i = 0; i < alarm_shard_count; i++)
+        heads[i] = scan_type_first(&alarm_shards[i], message_type);
+      while (1){
+            lowest = -1;
+            for (i = 0; i < alarm_shard_count; i++)
+                if (heads[i] != NULL && (lowest < 0 || heads[i]->number < heads[lowest]->number))
+                    lowest = i;
+            if (lowest < 0)
+                break;
+            next = heads[lowest];
+            heads[lowest] = scan_type_next(next);
+            state = ALARM_STATE(next);
+            if (ALARM_LIVE(state)){  
+                remaining_time = next->deadline - now;                    
+                /*expired, cancelled and replaced alarms have left the
+                live states, so they are simply skipped here*/
+                if (remaining_time >= 0 ){
+                    /*the first display moves the alarm on, a thread
+                    that loses the race still prints it*/
+                    if (state == ALARM_PENDING)
+                        __atomic_compare_exchange_n(&next->state, &state, ALARM_DISPLAYING, 0,
+                                                    __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+                    // printf("Alarm With Message Type (%d) and Message Number (%d) Displayed at <%ld>: <Type B>\n",
+                    //     message_type, next->number, time(NULL));
+                    printf("Printing message, Type : %d , Number : %d , Msg : %s , Tim : %ld\n",
+                    next->type,next->number, next->payload->message, remaining_time / 1000000000);
+                    
+                }
+            }
+      }
+    rcu_read_unlock();
+}
+
 
 
-/*The alarm thread function allows the createion of periodic_display_threads
+/*The alarm thread function allows the createion of periodic displays
   This is a reader method, it doesn't modify the alarm_list. It simply reads
   through and assigns an alarm to a thread.*/
 
 void * alarm_thread (void *arg){    
+    struct timespec cond_time;
+    long deadline;
+    int status;
+
     while(1){      
+        expire_alarms_that_are_due();
         remove_alarms_that_are_done();
         remove_threads_if_no_active_alarm();        
         check_thread_list_and_create_thread();   
         remove_alarms_in_removal_list();     
-        sleep(1);
+        rcu_reclaim();
+
+        /*the deadline is taken before alarm_mutex, work that arrives
+        after it sets alarm_work and is not missed*/
+        deadline = alarm_next_deadline();
+        lock_mutex_lock (&alarm_mutex, &alarm_mutex_stats);
+        current_alarm = deadline;
+        while (!alarm_work) {
+            if (current_alarm == 0) {
+                status = lock_cond_wait (&alarm_cond, &alarm_mutex, &alarm_mutex_stats, NULL);
+            } else {
+                cond_time.tv_sec = current_alarm / 1000000000;
+                cond_time.tv_nsec = current_alarm % 1000000000;
+                status = lock_cond_wait (&alarm_cond, &alarm_mutex, &alarm_mutex_stats, &cond_time);
+                if (status == ETIMEDOUT)
+                    break;
+            }
+            if (status != 0)
+                err_abort (status, "Wait on cond");
+        }
+        alarm_work = 0;
+        current_alarm = 0;
+        lock_mutex_unlock (&alarm_mutex, &alarm_mutex_stats);
     }
 }
 
+void alarm_thread_wake(){
+    int status;
+
+    /*the event loop runs the passes after every command itself*/
+    if (alarm_runtime == RUNTIME_EPOLL)
+        return;
+    lock_mutex_lock (&alarm_mutex, &alarm_mutex_stats);
+    alarm_work = 1;
+    status = pthread_cond_signal (&alarm_cond);
+    if (status != 0)
+        err_abort (status, "Signal cond");
+    lock_mutex_unlock (&alarm_mutex, &alarm_mutex_stats);
+}
 
-void invalid_input_error(){
-    printf("Bad Command. Usage: \nType A: <+ve integer> Message(Message_Type : <+ve integer>, Message_Number : <+ve integer>) <string message> \nType B: Create_Thread: MessageType(Message_Type : <+ve integer>) \nType C: Cancle: Message(Message_Number : <+ve integer>)\n");
+long alarm_next_deadline(){
+    alarm_shard_t *shard;
+    alarm_t *alarm;
+    long deadline = 0, next;
+    int i;
+
+    for(i = 0; i < alarm_shard_count; i++){
+        shard = &alarm_shards[i];
+        if(alarm_store == STORE_LOCKFREE){
+            /*there is no expiry engine, the earliest live alarm is looked for*/
+            next = 0;
+            rcu_read_lock();
+                for(alarm = lf_first(shard); alarm != NULL; alarm = lf_next(alarm))
+                    if(ALARM_LIVE(ALARM_STATE(alarm)) && (next == 0 || alarm->deadline < next))
+                        next = alarm->deadline;
+            rcu_read_unlock();
+        } else {
+            rw_read_lock(&shard->lock);
+                next = expiry_next_deadline(shard);
+            rw_read_unlock(&shard->lock);
+        }
+        if(next != 0 && (deadline == 0 || next < deadline))
+            deadline = next;
+    }
+    /*retired memory is freed once the readers have moved on, look again
+    in a second*/
+    if(__atomic_load_n(&rcu_retired, __ATOMIC_RELAXED) != NULL){
+        next = monotonic_ns() + 1000000000L;
+        if(deadline == 0 || next < deadline)
+            deadline = next;
+    }
+    return deadline;
 }
 
 
+void invalid_input_error(){
+    printf("Bad Command. Usage: \nType A: <+ve seconds, up to 3 decimals> Message(Message_Type : <+ve integer>, Message_Number : <+ve integer>) <string message> \nType B: Create_Thread: MessageType(Message_Type : <+ve integer>) \nType C: Cancle: Message(Message_Number : <+ve integer>) \nStats: Pools\nStats: Locks\n");
+}
 
 
-int main (int argc, char *argv[]){
-    /*initialize the semaphores*/
-    sem_init(&readCountAccess,0,1);
-    sem_init(&alarmListAccess,0,1);
-    sem_init(&t_threadListAccess,0,1);
-    sem_init(&t_readCountAccess,0,1);
-    sem_init(&r_threadListAccess,0,1);
-    sem_init(&r_readCountAccess,0,1);
 
-    /*local variables*/
+
+void start_writer(void * (*writer)(void *), void *arg, const char *what){
+    pthread_t writer_thread;
     int status;
-    char line[1500]; /*holds the initially entered string from user*/
-    char tempS[1000]; /*temporarily stores the message string*/
-    alarm_t *alarm;
 
-    /*thread creation id variable*/
+    if (alarm_runtime == RUNTIME_EPOLL){
+        writer(arg);
+        return;
+    }
+    status = pthread_create (&writer_thread, NULL, writer, arg);
+    if (status != 0)
+        err_abort (status, what);
+#ifdef DEGUG
+    pthread_join(writer_thread,NULL);
+#endif
+}
+
+void start_insert(alarm_t *alarm){
+    alarm_shard_t *shard = alarm_shard(alarm->number);
     pthread_t writer_thread;
-    pthread_t alr_thread;
+    int status;
 
-    /*create the alarm_thread thread*/
-    status = pthread_create(&alr_thread,NULL,alarm_thread,NULL);
+    if (alarm_runtime == RUNTIME_EPOLL){
+        add_to_alarm_list(alarm);
+        return;
+    }
+    /*inserts of one shard serialize on its lock anyway, waiting for
+    them keeps the requests for one message number in order. inserts of
+    different shards write at the same time*/
+    shard_inserts_wait(shard);
+    __atomic_add_fetch(&shard->inserts_running, 1, __ATOMIC_ACQ_REL);
+    status = pthread_create (&writer_thread, NULL, insert_writer, alarm);
     if (status != 0)
-        err_abort (status, "alarm_thread not created!\n");
-    
-    /*infinitely loops asking user for input*/
-    while (1) {
-        printf ("Alarm> ");
-        if (fgets (line, sizeof (line), stdin) == NULL) exit (0);
-        if (strlen (line) <= 1) continue;
+        err_abort (status, "Insert alarm into alarm list");
+    pthread_detach(writer_thread);
+}
+
+void * insert_writer(void *arg){
+    alarm_shard_t *shard = alarm_shard(((alarm_t *) arg)->number);
+
+    add_to_alarm_list(arg);
+    if (__atomic_sub_fetch(&shard->inserts_running, 1, __ATOMIC_ACQ_REL) == 0)
+        futex_wake_all(&shard->inserts_running);
+    return NULL;
+}
+
+void shard_inserts_wait(alarm_shard_t *shard){
+    unsigned int running;
+
+    while ((running = __atomic_load_n(&shard->inserts_running, __ATOMIC_ACQUIRE)) != 0)
+        futex_wait(&shard->inserts_running, running);
+}
 
-        alarm = (alarm_t*)malloc (sizeof (alarm_t));
-        if (alarm == NULL)
-            errno_abort ("Allocate alarm");
+void inserts_wait(){
+    int i;
+
+    for (i = 0; i < alarm_shard_count; i++)
+        shard_inserts_wait(&alarm_shards[i]);
+}
+
+void process_command(char *line){
+    char tempS[1001]; /*temporarily stores the message string*/
+    alarm_t *alarm;
+
+    if (strlen (line) <= 1) return;
+
+    /*Stats commands report on the program itself, they are not alarm requests*/
+    if (strncmp(line, "Stats: Pools", 12) == 0){
+        prt_pool_stats();
+        return;
+    }
+    if (strncmp(line, "Stats: Locks", 12) == 0){
+        prt_lock_stats();
+        return;
+    }
 // <><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><> INPUT PARSING BLOCK
-        /*
-         * Parse input line into seconds (%d) and a message
-         * (%128[^\n]), consisting of up to 64 characters
-         * separated from the seconds by whitespace.
-
-         Alarm> Time Message(Message_Type, Message_Number) Message
-         Alarm> Create_Thread: MessageType(Message_Type)
-         Alarm> Cancel: Message(Message_Number)
-         */
-         int err_t1, err_t2, err_t3;
-         int t1_sec, t1_type, t1_num;
-         char t1_msg[128];
-         int t2_type, t3_num;
-
-         err_t1 = sscanf(line,"%d Message(%d, %d) %1000[^\n]",&t1_sec,&t1_type,&t1_num,tempS);
-         strncpy(t1_msg, tempS, 128);
-         err_t2 = sscanf(line, "Create_Thread: MessageType(%d)",&t2_type);
-         err_t3 = sscanf(line, "Cancel: Message(%d)",&t3_num);
+    /*
+     * Parse input line into a duration in seconds with up to
+     * three decimals (%15[0-9.]) and a message (%1000[^\n]),
+     * consisting of up to 1000 characters separated from the
+     * duration by whitespace.
+
+     Alarm> Time Message(Message_Type, Message_Number) Message
+     Alarm> Create_Thread: MessageType(Message_Type)
+     Alarm> Cancel: Message(Message_Number)
+     */
+     int err_t1, err_t2, err_t3;
+     char t1_duration[16];
+     long t1_ms;
+     int t1_type, t1_num;
+     int t2_type, t3_num;
+
+     err_t1 = sscanf(line,"%15[0-9.] Message(%d, %d) %1000[^\n]",t1_duration,&t1_type,&t1_num,tempS);
+     err_t2 = sscanf(line, "Create_Thread: MessageType(%d)",&t2_type);
+     err_t3 = sscanf(line, "Cancel: Message(%d)",&t3_num);
 // <><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><> INPUT VALIDATION BLOCK
 
-         /*Check if there is any error in the commands entered,
-        if error exists, restart the loop*/
-        if (err_t1 < 4 && err_t2 < 1 && err_t3 < 1) {
+     /*Check if there is any error in the commands entered,
+    if error exists, restart the loop*/
+    if (err_t1 < 4 && err_t2 < 1 && err_t3 < 1) {
+        invalid_input_error();
+        return;
+    }
+    /*if alarm request command, thread creation and thread termination commands are
+     correct, check if the seconds and/or type of message have non negative values,
+      if negative values entered display error message and restart the loop*/
+    if(err_t1 == 4){
+        t1_ms = parse_duration_ms(t1_duration);
+        if (t1_ms <= 0 || t1_type <= 0 || t1_num <= 0){
             invalid_input_error();
-            continue;
-        }
-        /*if alarm request command, thread creation and thread termination commands are
-         correct, check if the seconds and/or type of message have non negative values,
-          if negative values entered display error message and restart the loop*/
-        if(err_t1 == 4){
-            if (t1_sec <= 0 || t1_type <= 0 || t1_num <= 0){
-                invalid_input_error();
-                continue;
-            }
+            return;
         }
-        else if(err_t2 == 1){
-            if (t2_type <= 0){
-                invalid_input_error();
-                continue;
-            }
+    }
+    else if(err_t2 == 1){
+        if (t2_type <= 0){
+            invalid_input_error();
+            return;
         }
-        else if(err_t3 == 1){
-            if (t3_num <= 0){
-                invalid_input_error();
-                continue;
-            }
+    }
+    else if(err_t3 == 1){
+        if (t3_num <= 0){
+            invalid_input_error();
+            return;
         }
+    }
 
 // <><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><> INPUT TYPE A ALARMS
 /*1==>*/if(err_t1 == 4){
-            alarm = (alarm_t*) malloc (sizeof (alarm_t));
-            if (alarm == NULL)
-                errno_abort ("Allocate alarm");
+        /*parse a Type A command and assign the element of the alarm*/
+        alarm = alarm_create(t1_ms, t1_type, t1_num, tempS);
 
-            /*parse a Type A command and assign the element of the alarm*/
-            alarm->seconds = t1_sec;
-            alarm->type = t1_type;
-            alarm->number = t1_num;
-            strncpy(alarm->message, t1_msg, 128);
-            alarm->time = time (NULL) + t1_sec;
-            alarm->is_done = 0;
+        /*call a writer thread to write to save the alarm created into the alarm thread.
+        it is not joined, the next Type A request is inserted alongside it*/
 
-            /*call a writer thread to write to save the alarm created into the alarm thread*/
-
-            status = pthread_create (&writer_thread, NULL, add_to_alarm_list, alarm);            
-            if (status != 0)
-                err_abort (status, "Insert alarm into alarm list");
-  #ifdef DEGUG
-              pthread_join(writer_thread,NULL);
-  #endif
+        start_insert(alarm);
 
 /* <><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><> INPUT TYPE B THREAD REQUEST*/
 /*2==>*/} else if (err_t2 == 1){
-            if(alarm_exists(t2_type,0)){
-                /*alarm exists in alarm_list, searched by type(0)*/
-                if (!thread_exists(t2_type)) {                    
-                    /*1 = exists; 0 = not; create thread it already not created*/
-                    status = pthread_create (&writer_thread, NULL, add_to_thread_list, &t2_type);
-                    if (status != 0)
-                        err_abort (status, "Create alarm thread");
-                    printf("Type B Create Thread Alarm Request For Message Type (%d) Inserted Into Alarm List at <%ld>!\n",
-                            t2_type,time(NULL)); 
-        #ifdef DEGUG
-                    pthread_join(writer_thread,NULL);
-        #endif                   
-                } else {
-                    /*thread with msg_num = tw_type exists ; print error*/
-                    printf("Error: More Than One Type B Alarm Request With Message Type (%d)!\n",t2_type);
-                }
+        /*the alarms typed before this request are in the list*/
+        inserts_wait();
+        if(alarm_exists(t2_type,0)){
+            /*alarm exists in alarm_list, searched by type(0)*/
+            if (!thread_exists(t2_type)) {                    
+                /*1 = exists; 0 = not; create thread it already not created*/
+                /*the type is passed by value, this frame is gone before
+                the writer thread reads it*/
+                start_writer(add_to_thread_list, (void *) (long) t2_type, "Create alarm thread");
+                printf("Type B Create Thread Alarm Request For Message Type (%d) Inserted Into Alarm List at <%ld>!\n",
+                        t2_type,time(NULL)); 
             } else {
-                printf("Type B Alarm Request Error: No Alarm Request With Message Type (%d)!\n",t2_type);
-            }             
+                /*thread with msg_num = tw_type exists ; print error*/
+                printf("Error: More Than One Type B Alarm Request With Message Type (%d)!\n",t2_type);
+            }
+        } else {
+            printf("Type B Alarm Request Error: No Alarm Request With Message Type (%d)!\n",t2_type);
+        }             
 /* <><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><> TYPE C TERMINATION INPUT REQUEST*/
 /*3==>*/}else if (err_t3 == 1){
-          
-          if(alarm_exists(t3_num,1)){
-              if(!remove_request_exists(t3_num)){
-                /*alarm with msg_number = t3_num exists; add to removal_list*/
-                add_to_removal_list(t3_num);
-                //  remove_alarm_request(t3_num);
-                printf("Type C Cancel Alarm Request With Message Number (%d) Inserted Into Alarm List at <%ld>: <Type C>\n",t3_num,time(NULL));
-              } else {
-                  printf("Error: More Than One Request to Cancel Alarm Request With Message Number (%d)!\n",t3_num);
-              }
+      
+      inserts_wait();
+      if(alarm_exists(t3_num,1)){
+          if(!remove_request_exists(t3_num)){
+            /*alarm with msg_number = t3_num exists; add to removal_queue*/
+            add_to_removal_list(t3_num);
+            //  remove_alarm_request(t3_num);
+            printf("Type C Cancel Alarm Request With Message Number (%d) Inserted Into Alarm List at <%ld>: <Type C>\n",t3_num,time(NULL));
           } else {
-              /*alarm with msg_number = t3_num exists not*/
-              printf("Error: No Alarm Request With Message Number (%d) to Cancel!\n",t3_num);
+              printf("Error: More Than One Request to Cancel Alarm Request With Message Number (%d)!\n",t3_num);
           }
+      } else {
+          /*alarm with msg_number = t3_num exists not*/
+          printf("Error: No Alarm Request With Message Number (%d) to Cancel!\n",t3_num);
+      }
+    }
+}
+
+void event_loop(){
+    struct epoll_event event, events[2];
+    struct itimerspec timer;
+    unsigned long long expirations;
+    static char input[4096];   /*input read so far, a partial line waits here*/
+    char line[1500];
+    size_t used = 0, length;
+    char *newline;
+    int epoll_fd, timer_fd, count, i, input_polled = 1, input_ready;
+    ssize_t got;
+    long deadline, display_next = 0, now;
+
+    epoll_fd = epoll_create1(0);
+    if (epoll_fd < 0)
+        errno_abort ("Create epoll");
+    timer_fd = timerfd_create(CLOCK_MONOTONIC, 0);
+    if (timer_fd < 0)
+        errno_abort ("Create timerfd");
+    event.events = EPOLLIN;
+    event.data.fd = timer_fd;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, timer_fd, &event) != 0)
+        errno_abort ("Watch timerfd");
+    event.data.fd = STDIN_FILENO;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, STDIN_FILENO, &event) != 0){
+        /*epoll refuses regular files, input redirected from a file is
+        always ready and is read without waiting*/
+        if (errno != EPERM)
+            errno_abort ("Watch input");
+        input_polled = 0;
+    }
+
+    printf ("Alarm> ");
+    fflush (stdout);
+    while (1) {
+        /*the same passes alarm_thread runs*/
+        expire_alarms_that_are_due();
+        remove_alarms_that_are_done();
+        remove_threads_if_no_active_alarm();        
+        check_thread_list_and_create_thread();   
+        remove_alarms_in_removal_list();     
+        rcu_reclaim();
+
+        /*one tick on every whole second of the monotonic clock displays
+        every type that has a display, like display_tick_thread, so a late
+        wakeup does not push the later ticks back. without displays there
+        is no tick*/
+        now = monotonic_ns();
+        if (thread_count == 0) {
+            display_next = 0;
+        } else if (display_next <= now) {
+            rw_read_lock(&thread_list_lock);
+                for (i = 0; i < thread_count; i++)
+                    if (thread_list[i]->is_created)
+                        display_type_alarms(thread_list[i]->type);
+            rw_read_unlock(&thread_list_lock);
+            display_next = (now / DISPLAY_PERIOD_NS + 1) * DISPLAY_PERIOD_NS;
+        }
+        fflush (stdout);
+
+        /*the timer is armed for whichever comes first, a zero value disarms it*/
+        deadline = alarm_next_deadline();
+        if (display_next != 0 && (deadline == 0 || display_next < deadline))
+            deadline = display_next;
+        memset(&timer, 0, sizeof(timer));
+        timer.it_value.tv_sec = deadline / 1000000000;
+        timer.it_value.tv_nsec = deadline % 1000000000;
+        if (timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &timer, NULL) != 0)
+            errno_abort ("Arm timerfd");
+
+        count = epoll_wait(epoll_fd, events, 2, input_polled ? -1 : 0);
+        if (count < 0) {
+            if (errno == EINTR)
+                continue;
+            errno_abort ("Wait on epoll");
+        }
+        input_ready = !input_polled;
+        for (i = 0; i < count; i++) {
+            if (events[i].data.fd == timer_fd)
+                read(timer_fd, &expirations, sizeof(expirations));
+            else
+                input_ready = 1;
+        }
+        if (!input_ready)
+            continue;
+
+        got = read(STDIN_FILENO, input + used, sizeof(input) - 1 - used);
+        if (got < 0) {
+            if (errno == EINTR || errno == EAGAIN)
+                continue;
+            errno_abort ("Read input");
+        }
+        used += got;
+        /*every complete line is a command, at the end of the input or
+        when the buffer is full the rest is taken as the last one*/
+        while (used > 0) {
+            newline = memchr(input, '\n', used);
+            if (newline != NULL)
+                length = newline - input + 1;
+            else if (got == 0 || used == sizeof(input) - 1)
+                length = used;
+            else
+                break;
+            if (length > sizeof(line) - 1)
+                length = sizeof(line) - 1;
+            memcpy(line, input, length);
+            line[length] = '\0';
+            memmove(input, input + length, used - length);
+            used -= length;
+            process_command(line);
+            printf ("Alarm> ");
+        }
+        fflush (stdout);
+        if (got == 0)
+            exit (0);
+    }
+}
+
+int main (int argc, char *argv[]){
+    int option;
+    pthread_condattr_t cond_attr;
+
+    /*initialize the locks and semaphores*/
+    alarm_shards_init();
+    rw_lock_init(&thread_list_lock, "thread_list", THREAD_LOCK_BACKEND, THREAD_LOCK_POLICY);
+    pool_init();
+    sem_init(&arenaAccess,0,1);
+    rcu_init();
+    /*deadlines are CLOCK_MONOTONIC, so is the timed wait on alarm_cond*/
+    pthread_condattr_init(&cond_attr);
+    pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&alarm_cond, &cond_attr);
+    pthread_condattr_destroy(&cond_attr);
+#ifdef LOCK_PROFILE
+    /*the profile is also printed when the program ends*/
+    atexit(prt_lock_stats);
+#endif
+
+    /*local variables*/
+    int status;
+    char line[1500]; /*holds the initially entered string from user*/
+
+    /*thread creation id variable*/
+    pthread_t alr_thread;
+
+    /*command line options:
+      -a backend[:policy]     the lock of every alarm_list shard, backend is sem,
+                              pthread or futex and policy is reader, writer or fair
+      -t backend[:policy]     the lock of thread_list
+      -l reader|writer|fair   the readers-writers protocol of the shard locks
+      -s shards               number of alarm_list shards, 1 to ALARM_SHARDS_MAX
+      -m locked|lockfree      the alarm store, see STORE_LOCKED and STORE_LOCKFREE
+      -e threads|epoll        the runtime, see RUNTIME_THREADS and RUNTIME_EPOLL
+      -b                      print the lock and store benchmarks and exit*/
+    while ((option = getopt(argc, argv, "a:t:l:s:m:e:b")) != -1) {
+        if (option == 'a' || option == 'l'){
+            char spec[64];
+            int i;
+            /*-l keeps the backend and only changes the protocol*/
+            if (option == 'l')
+                snprintf(spec, sizeof(spec), "%s:%s", rw_backend_names[alarm_shards[0].lock.backend], optarg);
+            else
+                snprintf(spec, sizeof(spec), "%s", optarg);
+            for (i = 0; i < ALARM_SHARDS_MAX; i++)
+                if (!rw_lock_configure(&alarm_shards[i].lock, spec))
+                    break;
+            if (i == ALARM_SHARDS_MAX)
+                continue;
+        } else if (option == 't' && rw_lock_configure(&thread_list_lock, optarg)){
+            continue;
+        } else if (option == 's' && atoi(optarg) >= 1 && atoi(optarg) <= ALARM_SHARDS_MAX){
+            alarm_shard_count = atoi(optarg);
+            continue;
+        } else if (option == 'm' && (strcmp(optarg, "locked") == 0 || strcmp(optarg, "lockfree") == 0)){
+            alarm_store = strcmp(optarg, "locked") == 0 ? STORE_LOCKED : STORE_LOCKFREE;
+            continue;
+        } else if (option == 'e' && (strcmp(optarg, "threads") == 0 || strcmp(optarg, "epoll") == 0)){
+            alarm_runtime = strcmp(optarg, "threads") == 0 ? RUNTIME_THREADS : RUNTIME_EPOLL;
+            continue;
+        } else if (option == 'b'){
+            alarm_lock_benchmark();
+            alarm_store_benchmark();
+            exit(0);
         }
+        fprintf(stderr, "Usage: %s [-a backend[:policy]] [-t backend[:policy]] [-l reader|writer|fair] [-s shards] [-m locked|lockfree] [-e threads|epoll] [-b]\n", argv[0]);
+        exit(1);
+    }
+
+    if (alarm_runtime == RUNTIME_EPOLL)
+        event_loop();
+
+    /*create the alarm_thread thread*/
+    status = pthread_create(&alr_thread,NULL,alarm_thread,NULL);
+    if (status != 0)
+        err_abort (status, "alarm_thread not created!\n");
+    display_workers_start();
+    
+    /*infinitely loops asking user for input*/
+    while (1) {
+        printf ("Alarm> ");
+        if (fgets (line, sizeof (line), stdin) == NULL) exit (0);
+        process_command(line);
     }
 }